@@ -45,9 +45,11 @@
  * UART line to communicate to another MCU also running a main and thread2 
  * thread. It seems as though stability deteriorates if the hdlc thread is given
  * a higher priority than the two application threads (RIOT's MAC layer priority
- * is well below the default priority for the main thread. Note that two threads
- * are equally contending for the UART line, one thread may starve the other to 
- * the point where the other thread will continue to retry. Increasing the msg 
+ * is well below the default priority for the main thread. The two threads
+ * contend for the UART line; the hdlc thread queues up to HDLC_TX_QUEUE_SIZE
+ * send requests per transmit class (both threads here are in the default
+ * HDLC_CLASS_NORMAL, and take turns by port) and only answers
+ * HDLC_RESP_RETRY_W_TIMEO when that queue is full. Increasing the msg 
  * queue size of hdlc's thread may also increase stability. Since this test can
  * easily stress the system, carefully picking the transmission rates (see below)
  * and tuning the RTRY_TIMEO_USEC and RETRANSMIT_TIMEO_USEC timeouts in hdlc.h
@@ -102,7 +104,6 @@ void _thread2()
     char thread2_frame_no = 0;
     msg_t *msg, *msg2;
     char send_data[HDLC_MAX_PKT_SIZE];
-    char recv_data[HDLC_MAX_PKT_SIZE];
     hdlc_pkt_t pkt;
     pkt.data = send_data;
     pkt.length = 0;
@@ -112,8 +113,11 @@ void _thread2()
     Mail<msg_t, HDLC_MAILBOX_SIZE> *hdlc_mailbox_ptr;
     hdlc_mailbox_ptr = get_hdlc_mailbox();
     int exit = 0;
-    hdlc_entry_t thread2 = { NULL, THREAD2_PORT, &thread2_mailbox };
-    hdlc_register(&thread2);
+    hdlc_entry_t thread2 = { THREAD2_PORT, &thread2_mailbox };
+    if (hdlc_register(&thread2) < 0) {
+        PRINTF("thread2: no room for port %d\n", THREAD2_PORT);
+        return;
+    }
 
     osEvent evt;
 
@@ -182,9 +186,8 @@ void _thread2()
                         buf = (hdlc_buf_t *)msg->content.ptr;   
                         uart_pkt_parse_hdr(&recv_hdr, buf->data, buf->length);
                         if (recv_hdr.pkt_type == PKT_FROM_THREAD2) {
-                            memcpy(recv_data, buf->data, buf->length);
                             printf("thread2: received pkt %d ; dst_port %d\n", 
-                            recv_data[UART_PKT_DATA_FIELD], recv_hdr.dst_port);
+                            buf->data[UART_PKT_DATA_FIELD], recv_hdr.dst_port);
                         }
                         thread2_mailbox.free(msg);
                         hdlc_pkt_release(buf);
@@ -216,7 +219,6 @@ int main(void)
     msg_t *msg, *msg2;
     char frame_no = 0;
     char send_data[HDLC_MAX_PKT_SIZE];
-    char recv_data[HDLC_MAX_PKT_SIZE];
     hdlc_pkt_t pkt;
     pkt.data = send_data;
     pkt.length = 0;
@@ -224,8 +226,11 @@ int main(void)
     uart_pkt_hdr_t recv_hdr;
     uart_pkt_hdr_t send_hdr = { MAIN_THR_PORT, MAIN_THR_PORT, PKT_FROM_MAIN_THR };
     PRINTF("In main\n");
-    hdlc_entry_t main_thr = { NULL, MAIN_THR_PORT, &main_thr_mailbox };
-    hdlc_register(&main_thr);
+    hdlc_entry_t main_thr = { MAIN_THR_PORT, &main_thr_mailbox };
+    if (hdlc_register(&main_thr) < 0) {
+        PRINTF("main: no room for port %d\n", MAIN_THR_PORT);
+        return 1;
+    }
 
     Thread thr;
     thr.start(_thread2);
@@ -300,9 +305,8 @@ int main(void)
                         buf = (hdlc_buf_t *)msg->content.ptr;   
                         uart_pkt_parse_hdr(&recv_hdr, buf->data, buf->length);
                         if (recv_hdr.pkt_type == PKT_FROM_MAIN_THR) {
-                            memcpy(recv_data, buf->data, buf->length);
                             printf("main_thr: received pkt %d ; dst_port %d\n", 
-                            recv_data[UART_PKT_DATA_FIELD], recv_hdr.dst_port);
+                            buf->data[UART_PKT_DATA_FIELD], recv_hdr.dst_port);
                         }
                         main_thr_mailbox.free(msg);
                         hdlc_pkt_release(buf);
@@ -46,9 +46,11 @@
  * UART line to communicate to another MCU also running a main and thread2 
  * thread. It seems as though stability deteriorates if the hdlc thread is given
  * a higher priority than the two application threads (RIOT's MAC layer priority
- * is well below the default priority for the main thread. Note that two threads
- * are equally contending for the UART line, one thread may starve the other to 
- * the point where the other thread will continue to retry. Increasing the msg 
+ * is well below the default priority for the main thread. The two threads
+ * contend for the UART line; the hdlc thread queues up to HDLC_TX_QUEUE_SIZE
+ * send requests per transmit class (both threads here are in the default
+ * HDLC_CLASS_NORMAL, and take turns by port) and only answers
+ * HDLC_RESP_RETRY_W_TIMEO when that queue is full. Increasing the msg 
  * queue size of hdlc's thread may also increase stability. Since this test can
  * easily stress the system, carefully picking the transmission rates (see below)
  * and tuning the RTRY_TIMEO_USEC and RETRANSMIT_TIMEO_USEC timeouts in hdlc.h
@@ -102,22 +104,36 @@ void _mqtt_thread()
 
     char mqtt_thread_frame_no = 0;
     msg_t *msg, *msg2;
-    char send_data[HDLC_MAX_PKT_SIZE];
     char recv_data[HDLC_MAX_PKT_SIZE];
     hdlc_pkt_t pkt;
     // void *rcv_data;
     mqtt_pkt_t *mqtt_recv;
-    pkt.data = send_data;
+    mqtt_pkt_t mqtt_send;
     char *test_str;
-    pkt.length = 0;
     uart_pkt_hdr_t send_hdr = { 0, 0, 0};
+    /* the header and the mqtt packet are framed from where they are */
+    yahdlc_iovec_t send_iov[2] = {
+        { &send_hdr, UART_PKT_HDR_LEN },
+        { &mqtt_send, sizeof(mqtt_pkt_t) }
+    };
+    if (hdlc_pkt_iov(&pkt, send_iov, 2) < 0) {
+        PRINTF("mqtt_thread: mqtt_pkt_t does not fit in a frame\n");
+        return;
+    }
+    /* all of it goes on the wire, not just the strings copied in below */
+    memset(&mqtt_send, 0, sizeof(mqtt_send));
+    /* pkt is framed from send_hdr and mqtt_send until HDLC_RESP_SND_SUCC */
+    int sending = 0, pub_owed = 0;
     hdlc_buf_t *buf;
     uart_pkt_hdr_t recv_hdr;
     Mail<msg_t, HDLC_MAILBOX_SIZE> *hdlc_mailbox_ptr;
     hdlc_mailbox_ptr = get_hdlc_mailbox();
     int exit = 0;
-    hdlc_entry_t mqtt_thread = { NULL, MBED_MQTT_PORT, &mqtt_thread_mailbox };
-    hdlc_register(&mqtt_thread);
+    hdlc_entry_t mqtt_thread = { MBED_MQTT_PORT, &mqtt_thread_mailbox };
+    if (hdlc_register(&mqtt_thread) < 0) {
+        PRINTF("mqtt_thread: no room for port %d\n", MBED_MQTT_PORT);
+        return;
+    }
 
     osEvent evt;
 
@@ -152,8 +168,6 @@ void _mqtt_thread()
     {
         // PRINTF("In mqtt_thread");
         myled3 =! myled3;
-        uart_pkt_insert_hdr(pkt.data, HDLC_MAX_PKT_SIZE, &send_hdr); 
-        pkt.length = HDLC_MAX_PKT_SIZE;        
 
         while(1)
         {
@@ -165,6 +179,18 @@ void _mqtt_thread()
                 {
                     case HDLC_RESP_SND_SUCC:
                         PRINTF("mqtt_thread: sent frame_no %d!\n", mqtt_thread_frame_no);
+                        sending = 0;
+                        if (pub_owed) {
+                            /* the same pub again, nothing to rewrite */
+                            pub_owed = 0;
+                            sending = 1;
+                            msg2 = hdlc_mailbox_ptr->alloc();
+                            msg2->type = HDLC_MSG_SND;
+                            msg2->content.ptr = &pkt;
+                            msg2->sender_pid = osThreadGetId();
+                            msg2->source_mailbox = &mqtt_thread_mailbox;
+                            hdlc_mailbox_ptr->put(msg2);
+                        }
                         exit = 1;
                         mqtt_thread_mailbox.free(msg);
                         break;    
@@ -218,13 +244,18 @@ void _mqtt_thread()
                                 hdlc_mailbox_ptr->put(msg);
                                 */
                                 // Mbed send a pub message to the broker
-                                strcpy(mqtt_recv->topic, TOPIC);
-                                strcpy(mqtt_recv->data, "This should be a pubbed");
+                                if (sending) {
+                                    /* the last one is still read from
+                                     * mqtt_send; send it once that is acked */
+                                    pub_owed = 1;
+                                    break;
+                                }
+                                sending = 1;
+                                strcpy(mqtt_send.topic, TOPIC);
+                                strcpy(mqtt_send.data, "This should be a pubbed");
                                 send_hdr.pkt_type = MQTT_PUB;
                                 send_hdr.src_port = MBED_MQTT_PORT;
                                 send_hdr.dst_port = RIOT_MQTT_PORT;
-                                uart_pkt_cpy_data(pkt.data, HDLC_MAX_PKT_SIZE, mqtt_recv, sizeof(mqtt_pkt_t));
-                                uart_pkt_insert_hdr(pkt.data, HDLC_MAX_PKT_SIZE, &send_hdr); 
 
                                 msg = hdlc_mailbox_ptr->alloc();
                                 msg->type = HDLC_MSG_SND;
@@ -288,8 +319,11 @@ int main(void)
     uart_pkt_hdr_t recv_hdr;
     uart_pkt_hdr_t send_hdr = { MAIN_THR_PORT, MAIN_THR_PORT, NULL_PKT_TYPE };
     PRINTF("In main\n");
-    hdlc_entry_t main_thr = { NULL, MAIN_THR_PORT, &main_thr_mailbox };
-    hdlc_register(&main_thr);
+    hdlc_entry_t main_thr = { MAIN_THR_PORT, &main_thr_mailbox };
+    if (hdlc_register(&main_thr) < 0) {
+        PRINTF("main: no room for port %d\n", MAIN_THR_PORT);
+        return 1;
+    }
     Thread thr;
     thr.start(_mqtt_thread);
 
@@ -25,36 +25,139 @@
  * 
 */
 
-static const unsigned short fcstab[256] = { 0x0000, 0x1189, 0x2312, 0x329b,
-    0x4624, 0x57ad, 0x6536, 0x74bf, 0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c,
-    0xdbe5, 0xe97e, 0xf8f7, 0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c,
-    0x75b7, 0x643e, 0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff,
-    0xe876, 0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-    0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5, 0x3183,
-    0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c, 0xbdcb, 0xac42,
-    0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974, 0x4204, 0x538d, 0x6116,
-    0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb, 0xce4c, 0xdfc5, 0xed5e, 0xfcd7,
-    0x8868, 0x99e1, 0xab7a, 0xbaf3, 0x5285, 0x430c, 0x7197, 0x601e, 0x14a1,
-    0x0528, 0x37b3, 0x263a, 0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960,
-    0xbbfb, 0xaa72, 0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630,
-    0x17b9, 0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-    0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738, 0xffcf,
-    0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70, 0x8408, 0x9581,
-    0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7, 0x0840, 0x19c9, 0x2b52,
-    0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff, 0x9489, 0x8500, 0xb79b, 0xa612,
-    0xd2ad, 0xc324, 0xf1bf, 0xe036, 0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5,
-    0x4f6c, 0x7df7, 0x6c7e, 0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7,
-    0xc03c, 0xd1b5, 0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74,
-    0x5dfd, 0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-    0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c, 0xc60c,
-    0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3, 0x4a44, 0x5bcd,
-    0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb, 0xd68d, 0xc704, 0xf59f,
-    0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232, 0x5ac5, 0x4b4c, 0x79d7, 0x685e,
-    0x1ce1, 0x0d68, 0x3ff3, 0x2e7a, 0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a,
-    0xb0a3, 0x8238, 0x93b1, 0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb,
-    0x0e70, 0x1ff9, 0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9,
-    0x8330, 0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78 };
+#include "fcs16.h"
+
+/** The FCS-16 polynomial x^16 + x^12 + x^5 + 1, bit reversed. */
+#define FCS16_POLY 0x8408
+
+/*
+ * The lookup tables are worked out by the compiler from FCS16_POLY.
+ * fcs16_shift<fcs, n> is @p fcs run through @p n zero bits, so the FCS of
+ * byte i is fcs16_shift<i, 8> and the nibble table is fcs16_shift<i, 4>.
+ * fcs16_tab<k, i> is the FCS of byte i followed by k zero bytes, the table
+ * a slice-by-N loop uses for the byte k places from the end of a step.
+ */
+template <unsigned int fcs, int n> struct fcs16_shift {
+    static const unsigned int value =
+        fcs16_shift<(fcs >> 1) ^ ((fcs & 1) ? FCS16_POLY : 0), n - 1>::value;
+};
+
+template <unsigned int fcs> struct fcs16_shift<fcs, 0> {
+    static const unsigned int value = fcs;
+};
+
+template <int k, unsigned int i> struct fcs16_tab {
+    static const unsigned int value = (fcs16_tab<k - 1, i>::value >> 8) ^
+        fcs16_tab<0, fcs16_tab<k - 1, i>::value & 0xff>::value;
+};
+
+template <unsigned int i> struct fcs16_tab<0, i> {
+    static const unsigned int value = fcs16_shift<i, 8>::value;
+};
+
+#define FCS16_NIB(i)    fcs16_shift<(i), 4>::value
+#define FCS16_TAB0(i)   fcs16_tab<0, (i)>::value
+#define FCS16_TAB1(i)   fcs16_tab<1, (i)>::value
+#define FCS16_TAB2(i)   fcs16_tab<2, (i)>::value
+#define FCS16_TAB3(i)   fcs16_tab<3, (i)>::value
+#define FCS16_TAB4(i)   fcs16_tab<4, (i)>::value
+#define FCS16_TAB5(i)   fcs16_tab<5, (i)>::value
+#define FCS16_TAB6(i)   fcs16_tab<6, (i)>::value
+#define FCS16_TAB7(i)   fcs16_tab<7, (i)>::value
+
+/* initializers for 16 and 256 entries of table @p T */
+#define FCS16_X4(T, i)  T(i), T((i) + 1), T((i) + 2), T((i) + 3)
+#define FCS16_X16(T, i) FCS16_X4(T, i), FCS16_X4(T, (i) + 4), \
+                        FCS16_X4(T, (i) + 8), FCS16_X4(T, (i) + 12)
+#define FCS16_X64(T, i) FCS16_X16(T, i), FCS16_X16(T, (i) + 16), \
+                        FCS16_X16(T, (i) + 32), FCS16_X16(T, (i) + 48)
+#define FCS16_X256(T)   FCS16_X64(T, 0), FCS16_X64(T, 64), \
+                        FCS16_X64(T, 128), FCS16_X64(T, 192)
+
+/* FCS of a nibble: 32 bytes for FCS16_NIBBLE images */
+static const unsigned short fcstab16[16] = { FCS16_X16(FCS16_NIB, 0) };
+
+/* FCS of a byte */
+static const unsigned short fcstab[256] = { FCS16_X256(FCS16_TAB0) };
+
+/*
+ * fcstab4[k - 1][i] is the FCS of byte i followed by k zero bytes, with
+ * fcstab[] as k = 0, so four bytes can be folded with four lookups.
+ */
+static const unsigned short fcstab4[3][256] = {
+    { FCS16_X256(FCS16_TAB1) },
+    { FCS16_X256(FCS16_TAB2) },
+    { FCS16_X256(FCS16_TAB3) }
+};
+
+/* The same for k = 4..7, for eight bytes per step. */
+static const unsigned short fcstab8[4][256] = {
+    { FCS16_X256(FCS16_TAB4) },
+    { FCS16_X256(FCS16_TAB5) },
+    { FCS16_X256(FCS16_TAB6) },
+    { FCS16_X256(FCS16_TAB7) }
+};
+
+static unsigned short fcs16_nibble(unsigned short fcs, unsigned char value) {
+    fcs = (fcs >> 4) ^ fcstab16[(fcs ^ value) & 0xf];
+    return (fcs >> 4) ^ fcstab16[(fcs ^ (value >> 4)) & 0xf];
+}
 
 unsigned short fcs16(unsigned short fcs, unsigned char value) {
+#if FCS16_NIBBLE
+    return fcs16_nibble(fcs, value);
+#else
     return (fcs >> 8) ^ fcstab[(fcs ^ value) & 0xff];
-}
\ No newline at end of file
+#endif
+}
+
+unsigned short fcs16_buf_nibble(unsigned short fcs, const unsigned char *buf,
+                                unsigned int len) {
+    while (len--) {
+        fcs = fcs16_nibble(fcs, *buf++);
+    }
+    return fcs;
+}
+
+unsigned short fcs16_buf_slice1(unsigned short fcs, const unsigned char *buf,
+                                unsigned int len) {
+    while (len--) {
+        fcs = (fcs >> 8) ^ fcstab[(fcs ^ *buf++) & 0xff];
+    }
+    return fcs;
+}
+
+unsigned short fcs16_buf_slice4(unsigned short fcs, const unsigned char *buf,
+                                unsigned int len) {
+    for (; len >= 4; len -= 4, buf += 4) {
+        fcs ^= buf[0] | (buf[1] << 8);
+        fcs = fcstab4[2][fcs & 0xff] ^ fcstab4[1][fcs >> 8] ^
+              fcstab4[0][buf[2]] ^ fcstab[buf[3]];
+    }
+    return fcs16_buf_slice1(fcs, buf, len);
+}
+
+unsigned short fcs16_buf_slice8(unsigned short fcs, const unsigned char *buf,
+                                unsigned int len) {
+    for (; len >= 8; len -= 8, buf += 8) {
+        fcs ^= buf[0] | (buf[1] << 8);
+        fcs = fcstab8[3][fcs & 0xff] ^ fcstab8[2][fcs >> 8] ^
+              fcstab8[1][buf[2]] ^ fcstab8[0][buf[3]] ^
+              fcstab4[2][buf[4]] ^ fcstab4[1][buf[5]] ^
+              fcstab4[0][buf[6]] ^ fcstab[buf[7]];
+    }
+    return fcs16_buf_slice4(fcs, buf, len);
+}
+
+unsigned short fcs16_buf(unsigned short fcs, const unsigned char *buf,
+                         unsigned int len) {
+#if FCS16_NIBBLE
+    return fcs16_buf_nibble(fcs, buf, len);
+#elif FCS16_SLICE >= 8
+    return fcs16_buf_slice8(fcs, buf, len);
+#elif FCS16_SLICE >= 4
+    return fcs16_buf_slice4(fcs, buf, len);
+#else
+    return fcs16_buf_slice1(fcs, buf, len);
+#endif
+}
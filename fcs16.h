@@ -33,6 +33,23 @@
 /** FCS value for valid frames. */
 #define FCS16_GOOD_VALUE 0xF0B8
 
+/**
+ * Bytes fcs16_buf() folds per step: 1, 4 or 8. Each step up costs another
+ * 1.5 KB (4) or 2 KB (8) of lookup tables in flash.
+ */
+#ifndef FCS16_SLICE
+#define FCS16_SLICE 4
+#endif
+
+/**
+ * Set to 1 to run fcs16() and fcs16_buf() a nibble at a time off a 32 byte
+ * table instead, for images that cannot spare the 512 byte one. Overrides
+ * FCS16_SLICE.
+ */
+#ifndef FCS16_NIBBLE
+#define FCS16_NIBBLE 0
+#endif
+
 // #ifdef __cplusplus
 // extern "C" {
 // #endif
@@ -46,6 +63,32 @@
  */
 unsigned short fcs16(unsigned short fcs, unsigned char value);
 
+/**
+ * Calculates a new FCS over a block of data, with the engine picked by
+ * FCS16_NIBBLE and FCS16_SLICE.
+ *
+ * @param fcs Current FCS value
+ * @param buf The data to be added
+ * @param len Length of the data
+ * @returns Calculated FCS value
+ */
+unsigned short fcs16_buf(unsigned short fcs, const unsigned char *buf,
+                         unsigned int len);
+
+/**
+ * The fcs16_buf() engines, a nibble, one byte, four bytes or eight bytes
+ * per table step. All give the same result; they are exported for
+ * benchmarking.
+ */
+unsigned short fcs16_buf_nibble(unsigned short fcs, const unsigned char *buf,
+                                unsigned int len);
+unsigned short fcs16_buf_slice1(unsigned short fcs, const unsigned char *buf,
+                                unsigned int len);
+unsigned short fcs16_buf_slice4(unsigned short fcs, const unsigned char *buf,
+                                unsigned int len);
+unsigned short fcs16_buf_slice8(unsigned short fcs, const unsigned char *buf,
+                                unsigned int len);
+
 // #ifdef __cplusplus
 // }
 // #endif
@@ -39,8 +39,9 @@
  * @file        hdlc.cpp
  * @brief       Full duplex hdlc implementation for mbed-os.
  *
- * This implementation leverages yahdlc, an open source library. The current 
- * implementation is stop & wait.
+ * This implementation leverages yahdlc, an open source library. Data frames
+ * are sent with a Go-Back-N sliding window of HDLC_WINDOW_SIZE frames and
+ * acknowledged cumulatively; a window of 1 is the original stop & wait.
  *
  * @author      Pradipta Ghosh <pradiptg@usc.edu>
  * @author      Jason A. Tran <jasontra@usc.edu>
@@ -51,7 +52,6 @@
 #include <inttypes.h>
 #include <errno.h>
 #include "mbed.h"
-#include "platform/CircularBuffer.h"
 #include "hdlc.h"
 #include "rtos.h"
 #include "uart_pkt.h"
@@ -59,114 +59,804 @@
 
 #define DEBUG 0
 
-#if (DEBUG) 
+#if (DEBUG)
     #define PRINTF(...) pc.printf(__VA_ARGS__)
     extern Serial pc;
 #else
     #define PRINTF(...)
 #endif /* (DEBUG) */
 
-#define UART_BUFSIZE            (512U)
-
 DigitalOut led2(LED2);
 
-static osThreadId sender_pid;
-
 static unsigned char HDLC_STACK[DEFAULT_STACK_SIZE];
 
-Thread hdlc(osPriorityNormal, 
-    (uint32_t) DEFAULT_STACK_SIZE, (unsigned char *)HDLC_STACK); 
+Thread hdlc(osPriorityNormal,
+    (uint32_t) DEFAULT_STACK_SIZE, (unsigned char *)HDLC_STACK);
+
+RawSerial uart2(p28,p27, 115200);
+
 
-Serial uart2(p28,p27, 115200);
+/* the link hdlc_init() sets up over uart2 */
+static hdlc_link_t hdlc_link;
+
+#if (HDLC_PORT_TABLE_SIZE & (HDLC_PORT_TABLE_SIZE - 1)) != 0
+#error "HDLC_PORT_TABLE_SIZE must be a power of two"
+#endif
+
+/* home slot of @p port: Fibonacci hashing spreads runs like 9000, 9100.. */
+static inline unsigned int _port_slot(uint16_t port)
+{
+    return ((uint32_t)port * 2654435769u >> 16) & (HDLC_PORT_TABLE_SIZE - 1);
+}
 
+static inline unsigned int _port_next(unsigned int i)
+{
+    return (i + 1) & (HDLC_PORT_TABLE_SIZE - 1);
+}
 
-static hdlc_entry_t *hdlc_reg;
+/**
+ * Marks an unregistered slot so probes carry on past it. Slots change by a
+ * single pointer store, or all at once in _port_rehash(), which
+ * hdlc_link_lookup() watches for rather than taking a lock; register and
+ * unregister serialise among themselves.
+ */
+static hdlc_entry_t _port_gone;
 
+/**
+ * Puts the live entries back from their home slots and drops the tombstones.
+ * Ports that come and go, as hdlc_rpc's do, can fill the table with
+ * tombstones alone. Under the critical section; hdlc_link_lookup() looks
+ * again if it missed while ports_moved changed.
+ */
+static void _port_rehash(hdlc_link_t *link)
+{
+    hdlc_entry_t *live[HDLC_PORT_TABLE_SIZE / 4 * 3];
+    unsigned int i, n = 0;
 
+    link->ports_moved++;
+    for (i = 0; i < HDLC_PORT_TABLE_SIZE; i++) {
+        if (link->ports[i] && link->ports[i] != &_port_gone) {
+            live[n++] = link->ports[i];
+        }
+        link->ports[i] = NULL;
+    }
+    link->num_ports = n;
+    while (n-- > 0) {
+        i = _port_slot(live[n]->port);
+        while (link->ports[i]) {
+            i = _port_next(i);
+        }
+        link->ports[i] = live[n];
+    }
+    link->ports_moved++;
+}
 
-void hdlc_register(hdlc_entry_t *entry)
+/**
+ * @brief Serve @p entry->port on @p link. A port registered twice is handed
+ *        to the newer entry.
+ * @return 0, or -1 if the port table is full (see HDLC_PORT_TABLE_SIZE).
+ */
+int hdlc_link_register(hdlc_link_t *link, hdlc_entry_t *entry)
 {
-    LL_PREPEND(hdlc_reg, entry);
+    unsigned int i = _port_slot(entry->port);
+    int free_slot = -1, ret = 0;
+    hdlc_entry_t *slot;
+
+    core_util_critical_section_enter();
+    while ((slot = link->ports[i]) && slot->port != entry->port) {
+        if (slot == &_port_gone && free_slot < 0) {
+            free_slot = i;
+        }
+        i = _port_next(i);
+    }
+    if (slot) {
+        link->ports[i] = entry;
+    } else if (free_slot >= 0) {
+        link->ports[free_slot] = entry;
+    } else {
+        if (link->num_ports == HDLC_PORT_TABLE_SIZE / 4 * 3) {
+            /* full, perhaps of tombstones off this port's probe run */
+            _port_rehash(link);
+            i = _port_slot(entry->port);
+            while (link->ports[i]) {
+                i = _port_next(i);
+            }
+        }
+        if (link->num_ports < HDLC_PORT_TABLE_SIZE / 4 * 3) {
+            link->ports[i] = entry;
+            link->num_ports++;
+        } else {
+            ret = -1;
+        }
+    }
+    core_util_critical_section_exit();
+    return ret;
+}
+
+void hdlc_link_unregister(hdlc_link_t *link, hdlc_entry_t *entry)
+{
+    unsigned int i = _port_slot(entry->port);
+
+    core_util_critical_section_enter();
+    while (link->ports[i] && link->ports[i] != entry) {
+        i = _port_next(i);
+    }
+    if (link->ports[i]) {
+        link->ports[i] = &_port_gone;
+        /* a tombstone that ends a probe run can go, and so can the ones
+         * before it */
+        while (link->ports[i] == &_port_gone && !link->ports[_port_next(i)]) {
+            link->ports[i] = NULL;
+            link->num_ports--;
+            i = (i - 1) & (HDLC_PORT_TABLE_SIZE - 1);
+        }
+    }
+    core_util_critical_section_exit();
+}
+
+/* the entry serving @p port on @p link, or NULL */
+hdlc_entry_t *hdlc_link_lookup(hdlc_link_t *link, uint16_t port)
+{
+    unsigned int i, moved;
+    hdlc_entry_t *entry;
+
+    do {
+        moved = link->ports_moved;
+        i = _port_slot(port);
+        while ((entry = link->ports[i]) && (entry == &_port_gone || entry->port != port)) {
+            i = _port_next(i);
+        }
+        /* a miss counts only if no _port_rehash() ran meanwhile */
+    } while (entry == NULL && ((moved & 1) || moved != link->ports_moved));
+    return entry;
+}
+
+int hdlc_register(hdlc_entry_t *entry)
+{
+    return hdlc_link_register(&hdlc_link, entry);
 }
 
 void hdlc_unregister(hdlc_entry_t *entry)
 {
-    LL_DELETE(hdlc_reg, entry);
+    hdlc_link_unregister(&hdlc_link, entry);
 }
 
+#if (HDLC_TX_RING_SIZE & (HDLC_TX_RING_SIZE - 1)) != 0
+#error "HDLC_TX_RING_SIZE must be a power of two"
+#endif
+#if (HDLC_RX_RING_SIZE & (HDLC_RX_RING_SIZE - 1)) != 0
+#error "HDLC_RX_RING_SIZE must be a power of two"
+#endif
+
+static unsigned int _hdlc_write_frame(hdlc_link_t *link,
+                                      yahdlc_control_t *control,
+                                      hdlc_pkt_t *pkt);
+static void _hdlc_write_slot(hdlc_link_t *link, hdlc_send_slot_t *slot);
+static void tx_cb(hdlc_link_t *link);
+
+/* delivered packets; buf must stay first so hdlc_pkt_release() can cast back */
+typedef struct hdlc_rx_buf {
+    hdlc_buf_t buf;
+    char data[HDLC_MAX_PKT_SIZE + 2];   /* the decoder adds the FCS */
+    hdlc_link_t *link;      /* woken on release if it is busy */
+    unsigned int refs;      /* holders, under a critical section */
+} hdlc_rx_buf_t;
 
-static Mail<msg_t, HDLC_MAILBOX_SIZE> *sender_mailbox_ptr;
-Mail<msg_t, HDLC_MAILBOX_SIZE> hdlc_mailbox;
-Semaphore   recv_buf_mutex(1);
-Semaphore   recv_buf_cpy_mutex(1); 
-// Mutex recv_buf_mutex;
-Timer       global_time;
-Timer       uart_lock_time;
+/**
+ * Shared by all links, a port thread does not care where a packet came from.
+ * A plain array rather than a MemoryPool so that hdlc_pkt_release() can tell
+ * a receive buffer from any other pointer before it touches it.
+ */
+static hdlc_rx_buf_t rx_bufs[HDLC_RX_POOL_SIZE];
+static hdlc_rx_buf_t *rx_free[HDLC_RX_POOL_SIZE];
+static unsigned int rx_free_count;     /* released buffers in rx_free[] */
+static unsigned int rx_used;           /* rx_bufs[] handed out at least once */
+
+#if (HDLC_WINDOW_SIZE < 1) || (HDLC_WINDOW_SIZE > 7)
+#error "HDLC_WINDOW_SIZE must be within 1..7 for 3 bit sequence numbers"
+#endif
+#if HDLC_SREJ && (HDLC_WINDOW_SIZE > 4)
+#error "HDLC_SREJ needs HDLC_WINDOW_SIZE <= 4 to tell held frames from duplicates"
+#endif
+#if (HDLC_TX_DEPTH_CONTROL < 1) || (HDLC_TX_DEPTH_CONTROL > HDLC_TX_QUEUE_SIZE)
+#error "HDLC_TX_DEPTH_CONTROL must be within 1..HDLC_TX_QUEUE_SIZE"
+#endif
+#if (HDLC_ACK_EVERY < 1) || (HDLC_ACK_EVERY > HDLC_WINDOW_SIZE)
+#error "HDLC_ACK_EVERY must be within 1..HDLC_WINDOW_SIZE"
+#endif
+
+static inline unsigned int _frames_in_flight(hdlc_link_t *link)
+{
+    return link->send_seq_no - link->send_base;
+}
+
+/**
+ * Retransmission timeout estimator (Jacobson/Karels as in RFC 6298). SRTT is
+ * kept scaled by 8 and RTTVAR by 4 so the 1/8 and 1/4 gains are shifts.
+ * rto_usec holds the timeout in use, including any exponential backoff.
+ */
+static uint32_t _rto_clamp(uint32_t rto)
+{
+    if (rto < HDLC_RTO_MIN_USEC) {
+        return HDLC_RTO_MIN_USEC;
+    }
+    if (rto > HDLC_RTO_MAX_USEC) {
+        return HDLC_RTO_MAX_USEC;
+    }
+    return rto;
+}
+
+static void _rto_sample(hdlc_link_t *link, uint32_t rtt)
+{
+    uint32_t err;
 
+    if (link->srtt_x8 == 0) {
+        /* first measurement */
+        link->srtt_x8 = rtt << 3;
+        link->rttvar_x4 = rtt << 1;
+    } else {
+        err = rtt > (link->srtt_x8 >> 3) ? rtt - (link->srtt_x8 >> 3) :
+                                           (link->srtt_x8 >> 3) - rtt;
+        link->rttvar_x4 = link->rttvar_x4 - (link->rttvar_x4 >> 2) + err;
+        link->srtt_x8 = link->srtt_x8 - (link->srtt_x8 >> 3) + rtt;
+    }
+    /* a fresh sample also ends any backoff */
+    link->rto_usec = _rto_clamp((link->srtt_x8 >> 3) + link->rttvar_x4);
+    PRINTF("hdlc: rtt %d us, srtt %d us, rto %d us\n", rtt,
+        link->srtt_x8 >> 3, link->rto_usec);
+}
 
-CircularBuffer<char, UART_BUFSIZE> circ_buf;
+static void _rto_backoff(hdlc_link_t *link)
+{
+    link->rto_usec = _rto_clamp(link->rto_usec * 2);
+}
 
-void write_hdlc(uint8_t *,int);
+uint32_t hdlc_link_get_rto_usec(hdlc_link_t *link)
+{
+    return link->rto_usec;
+}
 
-static char hdlc_recv_data[HDLC_MAX_PKT_SIZE];
-static char hdlc_recv_data_cpy[HDLC_MAX_PKT_SIZE];
+uint32_t hdlc_link_get_srtt_usec(hdlc_link_t *link)
+{
+    return link->srtt_x8 >> 3;
+}
 
-static char hdlc_send_frame[2 * (HDLC_MAX_PKT_SIZE + 2 + 2 + 2)];
-static char hdlc_ack_frame[2 + 2 + 2 + 2];
+void hdlc_link_get_stats(hdlc_link_t *link, hdlc_link_stats_t *stats)
+{
+    core_util_critical_section_enter();
+    *stats = link->stats;
+    core_util_critical_section_exit();
+}
 
+uint32_t hdlc_get_rto_usec(void)
+{
+    return hdlc_link_get_rto_usec(&hdlc_link);
+}
 
-static hdlc_buf_t recv_buf; // the initialization is done in the hdlc init function
-static hdlc_buf_t recv_buf_cpy; // the initialization is done in the hdlc init function
-static hdlc_buf_t send_buf;
-static hdlc_buf_t ack_buf;
+uint32_t hdlc_get_srtt_usec(void)
+{
+    return hdlc_link_get_srtt_usec(&hdlc_link);
+}
 
+void hdlc_get_stats(hdlc_link_stats_t *stats)
+{
+    hdlc_link_get_stats(&hdlc_link, stats);
+}
 
+/**
+ * Put @p msg in the link's mailbox and wake the thread serving it. The
+ * wakeup only matters on a shared thread, which waits on HDLC_SIG_WAKE
+ * rather than on any one mailbox. Safe from interrupt context.
+ */
+osStatus hdlc_link_post(hdlc_link_t *link, msg_t *msg)
+{
+    osStatus ret = link->mailbox.put(msg);
 
-/* uart access control lock */
-static bool uart_lock = 0;
+    if (link->shared && link->tid) {
+        osSignalSet(link->tid, HDLC_SIG_WAKE);
+    }
+    return ret;
+}
 
-static void rx_cb(void)//(void *arg, uint8_t data)
+static void rx_cb(hdlc_link_t *link)
 {
     unsigned char data;
+    bool wakeup = false;
 
-    while (uart2.readable()) {
-        data = uart2.getc();     // Get an character from the Serial
-        circ_buf.push(data);     // Put to the ring/circular buffer
+    while (link->uart->readable()) {
+        data = link->uart->getc();     // Get an character from the Serial
+        if (link->rx_head - link->rx_tail < HDLC_RX_RING_SIZE) {
+            link->rx_ring[link->rx_head % HDLC_RX_RING_SIZE] = data;
+            link->rx_head++;
+        } else {
+            link->stats.rx_overruns++;
+        }
 
         if (data == YAHDLC_FLAG_SEQUENCE) {
-            
-            // wakeup hdlc thread 
-            msg_t *msg = hdlc_mailbox.alloc();
-            if(msg == NULL)
-            {
-                  PRINTF("hdlc: rx_cb no more space available on mailbox\n");
-                  return;
+            wakeup = true;
+        }
+    }
+
+    // wakeup hdlc thread unless it already has a wakeup queued
+    if (wakeup && !link->rx_pending) {
+        link->rx_pending = true;
+        hdlc_link_post(link, link->rx_msg);
+    }
+}
+
+/* finish an hdlc_send_t; it is the caller's again once status is set */
+static void _hdlc_send_done(hdlc_link_t *link, hdlc_send_t *send,
+                            hdlc_send_status_t status)
+{
+    void (*done)(hdlc_send_t *) = send->done;
+    osThreadId thread = send->thread;
+    int32_t signals = send->signals;
+
+    if (send->timeout_ms && status != HDLC_SEND_REJECTED) {
+        link->send_timeouts--;
+    }
+    send->status = status;
+    if (done != NULL) {
+        done(send);
+    }
+    if (thread != NULL) {
+        osSignalSet(thread, signals);
+    }
+}
+
+/**
+ * Process a cumulative ACK: @p seq_no acknowledges every outstanding frame up
+ * to and including it. Values outside the window are stale and ignored.
+ */
+static void _hdlc_ack_received(hdlc_link_t *link, unsigned int seq_no)
+{
+    msg_t *msg;
+    hdlc_send_slot_t *slot;
+    unsigned int acked = (seq_no - link->send_base) % 8;
+    unsigned int base = link->send_base;
+
+    if (acked >= _frames_in_flight(link)) {
+        return;
+    }
+
+    slot = &link->send_win[(base + acked) % HDLC_WINDOW_SIZE];
+    if (!slot->retransmitted) {
+        _rto_sample(link, (uint32_t)(link->rtt_time.read_us() - slot->sent_at));
+    }
+
+    while (link->send_base != base + acked + 1) {
+        slot = &link->send_win[link->send_base % HDLC_WINDOW_SIZE];
+        if (slot->send != NULL) {
+            _hdlc_send_done(link, slot->send, HDLC_SEND_ACKED);
+        } else if (slot->sender_mailbox != NULL) {
+            msg = slot->sender_mailbox->alloc();
+            if (msg == NULL) {
+                /* leave it outstanding; a later (re)ACK completes it */
+                PRINTF("hdlc: no space in sender mailbox for SND_SUCC\n");
+                break;
             }
             msg->sender_pid = osThreadGetId();
-            msg->type = HDLC_MSG_RECV;
-            msg->source_mailbox = &hdlc_mailbox;
-            hdlc_mailbox.put(msg); 
+            msg->type = HDLC_RESP_SND_SUCC;
+            msg->content.value = (uint32_t) 0;
+            msg->source_mailbox = &link->mailbox;
+            slot->sender_mailbox->put(msg);
+            PRINTF("hdlc: frame %d acked, sender_pid is %d\n",
+                slot->control.seq_no, slot->sender_pid);
         }
+        link->send_base++;
     }
 
+    if (link->send_base != base) {
+        /* the retransmit timer now covers the new oldest frame */
+        link->global_time.reset();
+    }
 }
 
-static void _hdlc_receive(unsigned int *recv_seq_no, unsigned int *send_seq_no)
+/* send an ACK (RR), RNR, REJ or SREJ frame */
+static void _hdlc_write_sframe(hdlc_link_t *link, yahdlc_frame_t frame,
+                               unsigned int seq_no)
 {
-    msg_t *msg, *ack_msg;
-    int ret;
-    char c;
+    yahdlc_control_t control;
+
+    control.frame = frame;
+    control.seq_no = seq_no % 8;
+    control.recv_seq_no = 0;
+    _hdlc_write_frame(link, &control, NULL);
+    PRINTF("hdlc: sent s-frame %d w/ seq no %d\n", frame, control.seq_no);
+    if (frame == YAHDLC_FRAME_ACK) {
+        link->stats.tx_acks++;
+    } else if (frame == YAHDLC_FRAME_RNR) {
+        link->stats.tx_rnrs++;
+    } else {
+        link->stats.tx_rejects++;
+    }
+}
+
+/**
+ * ACK every frame accepted so far in a frame of its own, RNR while busy.
+ * Before the first frame there is nothing to ACK: N(R) - 1 would be 7.
+ */
+static void _hdlc_send_ack(hdlc_link_t *link)
+{
+    if (link->recv_seq_no != 0) {
+        _hdlc_write_sframe(link, HDLC_RNR && link->rx_busy ? YAHDLC_FRAME_RNR :
+                           YAHDLC_FRAME_ACK, link->recv_seq_no - 1);
+    }
+    link->ack_owed = 0;
+    link->ack_now = false;
+}
+
+/**
+ * Send the ACK owed for accepted frames once the link's ACK policy says so
+ * (see HDLC_ACK_EVERY), or a re-ACK a duplicate asked for. Returns how many
+ * ms the caller may sleep before it falls due.
+ */
+static uint32_t _hdlc_ack_timer(hdlc_link_t *link)
+{
+    int timeout;
+
+    if (link->ack_owed == 0 && !link->ack_now) {
+        return osWaitForever;
+    }
+    timeout = (int)link->ack_delay_usec - link->ack_time.read_us();
+    if (link->ack_now || timeout <= 0 || link->ack_owed >= link->ack_every) {
+        _hdlc_send_ack(link);
+        return osWaitForever;
+    }
+    return (uint32_t)(timeout + 999) / 1000;
+}
+
+/**
+ * @brief Let at most @p depth send requests from ports of @p tx_class wait
+ *        on @p link, clamped to 1..HDLC_TX_QUEUE_SIZE. Senders beyond that
+ *        are told to retry.
+ */
+void hdlc_link_set_class_depth(hdlc_link_t *link, unsigned int tx_class,
+                               unsigned int depth)
+{
+    if (tx_class >= HDLC_NUM_CLASSES) {
+        return;
+    }
+    if (depth < 1) {
+        depth = 1;
+    } else if (depth > HDLC_TX_QUEUE_SIZE) {
+        depth = HDLC_TX_QUEUE_SIZE;
+    }
+    link->tx_queue[tx_class].depth = depth;
+}
+
+/**
+ * @brief ACK frames accepted on @p link once @p every of them are owed or
+ *        @p delay_usec after the first. @p every is clamped to
+ *        1..HDLC_WINDOW_SIZE, beyond which the peer would stall.
+ */
+void hdlc_link_set_ack_policy(hdlc_link_t *link, unsigned int every,
+                              uint32_t delay_usec)
+{
+    if (every < 1) {
+        every = 1;
+    } else if (every > HDLC_WINDOW_SIZE) {
+        every = HDLC_WINDOW_SIZE;
+    }
+    link->ack_every = every;
+    link->ack_delay_usec = delay_usec;
+}
+
+/* resend one outstanding frame, with the current N(R) */
+static void _hdlc_resend_slot(hdlc_link_t *link, hdlc_send_slot_t *slot)
+{
+    PRINTF("hdlc: Resending frame w/ seq no %d (on send_seq_no %d)\n",
+        slot->control.seq_no, link->send_seq_no);
+    _hdlc_write_slot(link, slot);
+    slot->retransmitted = true;
+    link->stats.tx_resent++;
+}
+
+/* Go-Back-N: resend everything from the oldest frame */
+static void _hdlc_resend_window(hdlc_link_t *link)
+{
+    for (unsigned int i = link->send_base; i != link->send_seq_no; i++) {
+        _hdlc_resend_slot(link, &link->send_win[i % HDLC_WINDOW_SIZE]);
+    }
+    link->global_time.reset();
+}
+
+/**
+ * The peer asked for frames again: a REJ for everything from @p seq_no,
+ * acknowledging what came before, or an SREJ for @p seq_no alone. Either is
+ * answered at once and, unlike a timeout, does not back the RTO off.
+ */
+static void _hdlc_reject_received(hdlc_link_t *link, yahdlc_frame_t frame,
+                                  unsigned int seq_no)
+{
+    unsigned int offset;
+
+    if (frame == YAHDLC_FRAME_NACK) {
+        _hdlc_ack_received(link, seq_no - 1);
+        if (link->send_base % 8 == seq_no % 8) {
+            _hdlc_resend_window(link);
+        }
+        return;
+    }
+    offset = (seq_no - link->send_base) % 8;
+    if (offset < _frames_in_flight(link)) {
+        _hdlc_resend_slot(link, &link->send_win[(link->send_base + offset) %
+                                                HDLC_WINDOW_SIZE]);
+        if (offset == 0) {
+            link->global_time.reset();
+        }
+    }
+}
+
+static hdlc_rx_buf_t *_hdlc_rx_alloc(void)
+{
+    hdlc_rx_buf_t *rx_buf = NULL;
+
+    core_util_critical_section_enter();
+    if (rx_free_count > 0) {
+        rx_buf = rx_free[--rx_free_count];
+    } else if (rx_used < HDLC_RX_POOL_SIZE) {
+        rx_buf = &rx_bufs[rx_used++];
+    }
+    core_util_critical_section_exit();
+    return rx_buf;
+}
+
+static void _hdlc_rx_free(hdlc_rx_buf_t *rx_buf)
+{
+    core_util_critical_section_enter();
+    rx_free[rx_free_count++] = rx_buf;
+    core_util_critical_section_exit();
+}
+
+/* whether @p buf is the hdlc_buf_t of one of rx_bufs[] */
+static bool _hdlc_rx_owned(hdlc_buf_t *buf)
+{
+    uintptr_t off = (uintptr_t)buf - (uintptr_t)&rx_bufs[0];
+
+    return (uintptr_t)buf >= (uintptr_t)&rx_bufs[0] &&
+           off < sizeof(rx_bufs) && off % sizeof(rx_bufs[0]) == 0;
+}
+
+/**
+ * Where the decoder writes the next frame: a pool buffer, so that delivering
+ * it costs no copy, or recv_buf while the pool is empty. A frame in progress,
+ * even one only its control field is known of, keeps its buffer.
+ */
+static hdlc_buf_t *_hdlc_rx_dest(hdlc_link_t *link)
+{
+    if (HDLC_RX_LOAN && link->rx_loan == NULL &&
+        link->rx_state.src_index == 0) {
+        link->rx_loan = _hdlc_rx_alloc();
+        if (link->rx_loan) {
+            link->rx_loan->buf.data = link->rx_loan->data;
+            link->rx_loan->buf.control.frame = (yahdlc_frame_t)0;
+            link->rx_loan->buf.control.seq_no = 0;
+        }
+    }
+    return link->rx_loan ? &link->rx_loan->buf : &link->recv_buf;
+}
+
+/**
+ * Hand a received data frame to the thread serving its port. A frame the
+ * decoder wrote into a pool buffer is passed on as is; held frames are copied
+ * into one, the decoder's own if it is between frames. Returns -ENOMEM,
+ * without counting the frame, if there is no rx buffer or mail slot for it,
+ * and -ENOENT, counted as dropped, if no thread serves its port.
+ */
+static int _hdlc_deliver(hdlc_link_t *link, hdlc_buf_t *recv_buf)
+{
+    msg_t *msg;
     uart_pkt_hdr_t hdr;
     hdlc_entry_t *entry;
-    
-    while(1) {
-        if (!circ_buf.pop(c)) {
-            return;
+    hdlc_rx_buf_t *rx_buf;
+
+    PRINTF("hdlc: received data frame w/ seq_no: %d\n", recv_buf->control.seq_no);
+
+    /* a data frame without a header has no port to go to */
+    entry = NULL;
+    if (uart_pkt_parse_hdr(&hdr, recv_buf->data, recv_buf->length) == 0) {
+        entry = hdlc_link_lookup(link, hdr.dst_port);
+        PRINTF("hdlc: received packet for port %d\n", hdr.dst_port);
+    }
+
+    if (entry) {
+        /**
+         * Never block here: a port thread holding buffers may itself
+         * be waiting on this thread. The caller keeps the frame and
+         * sends RNR instead.
+         */
+        if (link->rx_loan && (recv_buf == &link->rx_loan->buf ||
+                              link->rx_state.src_index == 0)) {
+            rx_buf = link->rx_loan;
+        } else {
+            rx_buf = _hdlc_rx_alloc();
+        }
+        msg = rx_buf ? entry->mailbox->alloc() : NULL;
+        if (msg == NULL) {
+            PRINTF("hdlc: no rx buffer for port %d, link busy\n", hdr.dst_port);
+            if (rx_buf && rx_buf != link->rx_loan) {
+                _hdlc_rx_free(rx_buf);
+            }
+            return -ENOMEM;
+        }
+        if (rx_buf == link->rx_loan) {
+            link->rx_loan = NULL;
+        }
+        if (recv_buf != &rx_buf->buf) {
+            rx_buf->buf.data = rx_buf->data;
+            buffer_cpy(&rx_buf->buf, recv_buf);
         }
-        recv_buf_mutex.wait();
-        ret = yahdlc_get_data(&recv_buf.control, &c, 1, recv_buf.data, 
-                                &recv_buf.length);
-        recv_buf_mutex.release();
+        rx_buf->link = link;
+        rx_buf->refs = 1;
+
+        msg->sender_pid = osThreadGetId();
+        msg->type = HDLC_PKT_RDY;
+        msg->content.ptr = &rx_buf->buf;
+        msg->source_mailbox = &link->mailbox;
+        entry->mailbox->put(msg);
+    } else {
+        PRINTF("hdlc: no thread subscribed to port!\n");
+        link->stats.rx_dropped++;
+        return -ENOENT;
+    }
+    return 0;
+}
+
+/**
+ * @p buf is the frame numbered recv_seq_no: deliver it and any held frames
+ * that now follow in order. The next data frame out carries the ACK, else
+ * _hdlc_ack_timer() sends it. Returns -ENOMEM with the first frame that
+ * could not be delivered copied to busy_buf.
+ */
+static int _hdlc_accept(hdlc_link_t *link, hdlc_buf_t *buf)
+{
+#if HDLC_SREJ
+    unsigned int slot;
+#endif
+
+    while (1) {
+        /* a frame nobody subscribed to still takes its sequence number */
+        if (_hdlc_deliver(link, buf) == -ENOMEM) {
+            if (buf != &link->busy_buf) {
+                buffer_cpy(&link->busy_buf, buf);
+            }
+            return -ENOMEM;
+        }
+        link->stats.rx_frames++;
+        link->recv_seq_no++;
+        link->rej_sent = false;
+        if (link->ack_owed++ == 0) {
+            link->ack_time.reset();
+        }
+#if HDLC_SREJ
+        slot = link->recv_seq_no % HDLC_WINDOW_SIZE;
+        link->srej_sent &= ~(1 << slot);
+        if (!(link->ooo_held & (1 << slot))) {
+            break;
+        }
+        link->ooo_held &= ~(1 << slot);
+        buf = &link->ooo_buf[slot];
+#else
+        break;
+#endif
+    }
+    return 0;
+}
+
+/* no room for frame recv_seq_no: keep it and tell the peer to hold off */
+static void _hdlc_busy_enter(hdlc_link_t *link)
+{
+    link->rx_busy = true;
+    link->busy_polled_at = link->rtt_time.read_us();
+    _hdlc_send_ack(link);
+}
+
+/**
+ * Try the frame that made the link busy again. The peer hears about any
+ * progress, an RR once everything held is delivered or another RNR, and a
+ * peer that @p polled with a resend of the frame gets an answer either way.
+ */
+static void _hdlc_busy_retry(hdlc_link_t *link, bool polled)
+{
+    unsigned int seq_no = link->recv_seq_no;
+
+    link->busy_polled_at = link->rtt_time.read_us();
+    link->rx_busy = _hdlc_accept(link, &link->busy_buf) < 0;
+    if (polled || link->recv_seq_no != seq_no) {
+        _hdlc_send_ack(link);
+    }
+}
+
+/**
+ * While busy, retry every HDLC_BUSY_POLL_USEC: a port thread freeing its
+ * mail does not wake us. Returns how many ms the caller may sleep.
+ */
+static uint32_t _hdlc_busy_timer(hdlc_link_t *link)
+{
+    int timeout;
+
+    if (!link->rx_busy) {
+        return osWaitForever;
+    }
+    timeout = HDLC_BUSY_POLL_USEC -
+        (link->rtt_time.read_us() - link->busy_polled_at);
+    if (timeout <= 0) {
+        _hdlc_busy_retry(link, false);
+        if (!link->rx_busy) {
+            return osWaitForever;
+        }
+        timeout = HDLC_BUSY_POLL_USEC;
+    }
+    return (uint32_t)(timeout + 999) / 1000;
+}
+
+/**
+ * A data frame @p ahead (mod 8) of the one expected. With HDLC_SREJ a frame
+ * inside the window is held and every missing frame before it asked for
+ * once; anything else is a duplicate and gets a re-ACK. Without it a REJ
+ * asks for everything from the expected frame, or with neither a re-ACK
+ * leaves that to the peer's retransmit timer. Nothing is asked for while
+ * busy; the peer resends after our RR.
+ */
+static void _hdlc_out_of_seq(hdlc_link_t *link, hdlc_buf_t *buf,
+                             unsigned int ahead)
+{
+    PRINTF("hdlc: data frame w/ seq_no: %d, expected %d\n",
+        buf->control.seq_no, link->recv_seq_no % 8);
+    link->stats.rx_out_of_seq++;
+#if HDLC_SREJ
+    unsigned int slot;
+
+    if (ahead >= HDLC_WINDOW_SIZE) {
+        link->ack_now = true;
+        return;
+    }
+    slot = (link->recv_seq_no + ahead) % HDLC_WINDOW_SIZE;
+    if (!(link->ooo_held & (1 << slot))) {
+        link->ooo_buf[slot].data = link->ooo_data[slot];
+        buffer_cpy(&link->ooo_buf[slot], buf);
+        link->ooo_held |= 1 << slot;
+        link->srej_sent &= ~(1 << slot);
+    }
+    for (unsigned int i = 0; i < ahead && !link->rx_busy; i++) {
+        slot = (link->recv_seq_no + i) % HDLC_WINDOW_SIZE;
+        if (!((link->ooo_held | link->srej_sent) & (1 << slot))) {
+            _hdlc_write_sframe(link, YAHDLC_FRAME_SREJ, link->recv_seq_no + i);
+            link->srej_sent |= 1 << slot;
+        }
+    }
+#elif HDLC_REJ
+    (void)ahead;
+    if (!link->rej_sent && !link->rx_busy) {
+        _hdlc_write_sframe(link, YAHDLC_FRAME_NACK, link->recv_seq_no);
+        link->rej_sent = true;
+    }
+#else
+    (void)ahead;
+    link->ack_now = true;
+#endif
+}
+
+/* Parse and dispatch every complete frame waiting in the link's rx ring. */
+static void _hdlc_receive(hdlc_link_t *link)
+{
+    int ret;
+    unsigned int tail, len, used, ahead;
+    hdlc_buf_t *recv_buf;
+
+    while (link->rx_tail != link->rx_head) {
+        recv_buf = _hdlc_rx_dest(link);
+        /* hand the decoder everything up to the head or the end of the ring */
+        tail = link->rx_tail % HDLC_RX_RING_SIZE;
+        len = link->rx_head - link->rx_tail;
+        if (len > HDLC_RX_RING_SIZE - tail) {
+            len = HDLC_RX_RING_SIZE - tail;
+        }
+        ret = yahdlc_get_data_span(&link->rx_state, &recv_buf->control,
+                &link->rx_ring[tail], len, recv_buf->data,
+                HDLC_MAX_PKT_SIZE + 2, &recv_buf->length, &used);
+        link->rx_tail += used;
 
         if (ret == -ENOMSG) {
             continue; //full packet not yet parsed
@@ -174,360 +864,1001 @@ static void _hdlc_receive(unsigned int *recv_seq_no, unsigned int *send_seq_no)
 
         if (ret == -EIO) {
             PRINTF("FCS ERROR OR INVALID FRAME!\n");
-            recv_buf.control.frame = (yahdlc_frame_t)0;
-            recv_buf.control.seq_no = 0;
-            return;
-        }
-
-        if (recv_buf.length > 0 && 
-            (recv_buf.control.seq_no == *recv_seq_no % 8 ||
-            recv_buf.control.seq_no == (*recv_seq_no - 1) % 8)) {
-            /* valid data frame received */
-            PRINTF("hdlc: received data frame w/ seq_no: %d\n", recv_buf.control.seq_no);
-
-            /* always send ack. This maybe bogging down the mailbox */
-            ack_msg = hdlc_mailbox.alloc();
-            if (ack_msg == NULL)
-            {
-              PRINTF("hdlc: ACK no more space available on mailbox\n");
-              return;
+            link->stats.rx_errors++;
+            /* it may have been the frame we wait for: ask for it right away */
+            if (HDLC_REJ && !link->rej_sent && !link->rx_busy) {
+                _hdlc_write_sframe(link, YAHDLC_FRAME_NACK, link->recv_seq_no);
+                link->rej_sent = true;
             }
-            ack_msg->sender_pid = osThreadGetId();
-            ack_msg->type = HDLC_MSG_SND_ACK;
-            ack_msg->content.value = recv_buf.control.seq_no;
-            ack_msg->source_mailbox = &hdlc_mailbox;
-            hdlc_mailbox.put(ack_msg); 
-            PRINTF("hdlc: received data frame w/ seq_no: %d\n", recv_buf.control.seq_no);
-
-            /* pass on packet to thread */
-            if (recv_buf.control.seq_no == (*recv_seq_no % 8)){
-                /* lock pkt until thread makes a copy and unlocks */
-                PRINTF("hdlc: received data frame w/ seq_no: %d\n", recv_buf.control.seq_no);
-                fflush(stdout);
-                recv_buf_cpy_mutex.wait();
-                recv_buf_mutex.wait();
-                buffer_cpy(&recv_buf_cpy,&recv_buf);
-                recv_buf_mutex.release();
-                uart_pkt_parse_hdr(&hdr, recv_buf_cpy.data, recv_buf_cpy.length);
-                LL_SEARCH_SCALAR(hdlc_reg, entry, port, hdr.dst_port);
-                PRINTF("hdlc: received packet for port %d\n", hdr.dst_port);
-
-                (*recv_seq_no)++;
-
-                if (entry) {
-                    msg = entry->mailbox->alloc();
-                    if( msg == NULL)
-                        break;
-                    msg->sender_pid = osThreadGetId();
-                    msg->type = HDLC_PKT_RDY;
-                    msg->content.ptr = &recv_buf_cpy;
-                    msg->source_mailbox = &hdlc_mailbox;
-                    entry->mailbox->put(msg);
-                } else {
-                    PRINTF("hdlc: no thread subscribed to port!\n");
-                    hdlc_pkt_release(&recv_buf_cpy);
+            recv_buf->control.frame = (yahdlc_frame_t)0;
+            recv_buf->control.seq_no = 0;
+            continue;
+        }
+
+#if HDLC_PIGGYBACK_ACKS
+        if (recv_buf->control.frame == YAHDLC_FRAME_DATA) {
+            /* N(R) is the next frame the peer expects from us */
+            _hdlc_ack_received(link, recv_buf->control.recv_seq_no - 1u);
+        }
+#endif
+
+        if (recv_buf->control.frame == YAHDLC_FRAME_DATA) {
+            ahead = (recv_buf->control.seq_no - link->recv_seq_no) % 8;
+            if (ahead == 0 && link->rx_busy) {
+                /* the peer polls with the frame we still hold */
+                _hdlc_busy_retry(link, true);
+            } else if (ahead == 0) {
+                if (_hdlc_accept(link, recv_buf) < 0) {
+                    _hdlc_busy_enter(link);
                 }
+            } else {
+                _hdlc_out_of_seq(link, recv_buf, ahead);
+            }
+        } else if (recv_buf->control.frame == YAHDLC_FRAME_UI) {
+            /* best effort: no sequence, no ACK, no RNR */
+            ret = _hdlc_deliver(link, recv_buf);
+            if (ret == 0) {
+                link->stats.rx_datagrams++;
+            } else if (ret == -ENOMEM) {
+                link->stats.rx_dropped++;
             }
+        } else if (recv_buf->length == 0 &&
+                   recv_buf->control.frame == YAHDLC_FRAME_ACK) {
+            PRINTF("hdlc: received ACK w/ seq_no: %d\n", recv_buf->control.seq_no);
+            link->stats.rx_acks++;
+            _hdlc_ack_received(link, recv_buf->control.seq_no);
+            if (link->peer_busy) {
+                link->peer_busy = false;
+#if !HDLC_SREJ
+                /* RR: the peer dropped whatever came after the frame it held */
+                _hdlc_resend_window(link);
+#endif
+            }
+        } else if (recv_buf->length == 0 &&
+                   recv_buf->control.frame == YAHDLC_FRAME_RNR) {
+            PRINTF("hdlc: received RNR w/ seq_no: %d\n", recv_buf->control.seq_no);
+            link->stats.rx_rnrs++;
+            _hdlc_ack_received(link, recv_buf->control.seq_no);
+            link->peer_busy = true;
+        } else if (recv_buf->length == 0) {
+            PRINTF("hdlc: received REJ/SREJ w/ seq_no: %d\n", recv_buf->control.seq_no);
+            link->stats.rx_rejects++;
+            link->peer_busy = false;
+            _hdlc_reject_received(link, recv_buf->control.frame,
+                                  recv_buf->control.seq_no);
+        }
+        /* a delivered frame belongs to its port thread now */
+        if (recv_buf == &link->recv_buf || link->rx_loan != NULL) {
+            recv_buf->control.frame = (yahdlc_frame_t)0;
+            recv_buf->control.seq_no = 0;
+        }
+    }
+}
 
-            recv_buf.control.frame = (yahdlc_frame_t)0;
-            recv_buf.control.seq_no =  0;
-            return;
-
-        } else if (recv_buf.length == 0 &&
-                    (recv_buf.control.frame == YAHDLC_FRAME_ACK ||
-                     recv_buf.control.frame == YAHDLC_FRAME_NACK)) {
-            PRINTF("hdlc: received ACK/NACK w/ seq_no: %d\n", recv_buf.control.seq_no);
-
-            if(recv_buf.control.seq_no == (*send_seq_no % 8)) {
-                msg=sender_mailbox_ptr->alloc();
-                if (msg == NULL)
-                    return;
-
-                uart_lock = 0;
-                (*send_seq_no)++;
-                msg->sender_pid = osThreadGetId();
-                msg->type = HDLC_RESP_SND_SUCC;
-                msg->content.value = (uint32_t) 0;
-                msg->source_mailbox = &hdlc_mailbox;
-                sender_mailbox_ptr->put(msg);
-                PRINTF("hdlc: sender_pid is %d\n", sender_pid);
+/**
+ * Send the slot's frame with the current N(R), encoded from the sender's
+ * packet; until the frame is ACKed that buffer must stay valid, as it always
+ * had to. Once its send timed out the frame goes from the slot's own copy.
+ */
+static void _hdlc_write_slot(hdlc_link_t *link, hdlc_send_slot_t *slot)
+{
+    slot->control.recv_seq_no = link->recv_seq_no % 8;
+    _hdlc_write_frame(link, &slot->control, slot->pkt);
+#if HDLC_PIGGYBACK_ACKS
+    link->ack_owed = 0;
+    link->ack_now = false;
+#endif
+}
+
+/**
+ * The transmit class of a packet is that of the port it is sent from, which
+ * is also the flow it queues in (@p port).
+ */
+static unsigned int _hdlc_tx_class(hdlc_link_t *link, hdlc_pkt_t *pkt,
+                                   uint16_t *port)
+{
+    uart_pkt_hdr_t hdr;
+    hdlc_entry_t *entry;
+
+    if (hdlc_pkt_parse_hdr(&hdr, pkt) < 0) {
+        *port = 0;
+        return HDLC_CLASS_NORMAL;
+    }
+    *port = hdr.src_port;
+    entry = hdlc_link_lookup(link, hdr.src_port);
+    if (entry == NULL || entry->tx_class >= HDLC_NUM_CLASSES) {
+        return HDLC_CLASS_NORMAL;
+    }
+    return entry->tx_class;
+}
+
+/* queue @p req behind the others from @p port, which joins the round last */
+static void _hdlc_tx_enqueue(hdlc_tx_queue_t *queue, uint16_t port,
+                             hdlc_tx_req_t *req)
+{
+    hdlc_tx_flow_t *flow;
+
+    req->next = NULL;
+    CDL_SEARCH_SCALAR(queue->cur, flow, port, port);
+    if (flow == NULL) {
+        flow = queue->free_flows;
+        LL_DELETE(queue->free_flows, flow);
+        flow->port = port;
+        flow->reqs = NULL;
+        flow->deficit = 0;
+        CDL_PREPEND(queue->cur, flow);
+        if (flow->next == flow) {
+            /* alone, so it is served now */
+            flow->deficit = HDLC_MAX_PKT_SIZE;
+        } else {
+            /* back to the one being served, with flow as the last */
+            queue->cur = flow->next;
+        }
+    }
+    LL_APPEND(flow->reqs, req);
+    queue->count++;
+}
+
+/* @p flow has run dry: it leaves the round and forfeits what it had left */
+static void _hdlc_tx_flow_done(hdlc_tx_queue_t *queue, hdlc_tx_flow_t *flow)
+{
+    bool served = flow == queue->cur;
+
+    CDL_DELETE(queue->cur, flow);
+    LL_PREPEND(queue->free_flows, flow);
+    if (served && queue->cur != NULL) {
+        queue->cur->deficit += HDLC_MAX_PKT_SIZE;
+    }
+}
+
+/**
+ * Take the next request of @p queue in deficit round robin order: the
+ * current flow sends while its deficit covers its next packet, then the
+ * next one is credited another HDLC_MAX_PKT_SIZE bytes.
+ */
+static hdlc_tx_req_t *_hdlc_tx_dequeue(hdlc_tx_queue_t *queue)
+{
+    hdlc_tx_flow_t *flow;
+    hdlc_tx_req_t *req;
+
+    while (queue->cur->deficit < (int)queue->cur->reqs->pkt->length) {
+        queue->cur = queue->cur->next;
+        queue->cur->deficit += HDLC_MAX_PKT_SIZE;
+    }
+    flow = queue->cur;
+    req = flow->reqs;
+    LL_DELETE(flow->reqs, req);
+    flow->deficit -= req->pkt->length;
+    queue->count--;
+    if (flow->reqs == NULL) {
+        _hdlc_tx_flow_done(queue, flow);
+    }
+    return req;
+}
+
+/* how long the oldest request of @p queue has waited */
+static int _hdlc_tx_waited(hdlc_tx_queue_t *queue, int now)
+{
+    hdlc_tx_flow_t *flow;
+    int waited = 0;
+
+    CDL_FOREACH(queue->cur, flow) {
+        if (now - flow->reqs->queued_at > waited) {
+            waited = now - flow->reqs->queued_at;
+        }
+    }
+    return waited;
+}
+
+/**
+ * The queue to take the next send request from: the highest class that has
+ * one, unless a request of some class has waited HDLC_TX_AGING_USEC, in
+ * which case the class that has waited longest.
+ */
+static hdlc_tx_queue_t *_hdlc_tx_pick(hdlc_link_t *link)
+{
+    static const uint8_t order[HDLC_NUM_CLASSES] = {
+        HDLC_CLASS_CONTROL, HDLC_CLASS_NORMAL, HDLC_CLASS_BULK
+    };
+    hdlc_tx_queue_t *queue, *first = NULL, *aged = NULL;
+    int now = link->rtt_time.read_us();
+    int age, oldest = 0;
+
+    for (int i = 0; i < HDLC_NUM_CLASSES; i++) {
+        queue = &link->tx_queue[order[i]];
+        if (queue->count == 0) {
+            continue;
+        }
+        if (first == NULL) {
+            first = queue;
+        }
+        age = _hdlc_tx_waited(queue, now);
+        if (age >= HDLC_TX_AGING_USEC && (aged == NULL || age > oldest)) {
+            aged = queue;
+            oldest = age;
+        }
+    }
+    if (aged != NULL && aged != first) {
+        link->stats.tx_aged++;
+        return aged;
+    }
+    return first;
+}
+
+/**
+ * Move queued send requests into the window while it has room. The request's
+ * packet is encoded from the sender's buffer on every (re)send, so that must
+ * stay valid until it gets HDLC_RESP_SND_SUCC (as it always had to).
+ */
+static void _hdlc_send_pending(hdlc_link_t *link)
+{
+    hdlc_tx_queue_t *queue;
+    hdlc_tx_req_t *req;
+    hdlc_send_slot_t *slot;
+
+    while (link->tx_queued > 0 && _frames_in_flight(link) < HDLC_WINDOW_SIZE &&
+           !link->peer_busy) {
+        queue = _hdlc_tx_pick(link);
+        req = _hdlc_tx_dequeue(queue);
+        slot = &link->send_win[link->send_seq_no % HDLC_WINDOW_SIZE];
+        slot->send = req->send;
+        slot->sender_pid = req->sender_pid;
+        slot->sender_mailbox = req->sender_mailbox;
+        PRINTF("hdlc: sender_pid set to %d\n", slot->sender_pid);
+        slot->pkt = req->pkt;
+        slot->control.frame = YAHDLC_FRAME_DATA;
+        slot->control.seq_no = link->send_seq_no % 8;
+        LL_PREPEND(queue->free_reqs, req);
+        link->tx_queued--;
+
+        PRINTF("hdlc: sending frame seq no %d, len %d\n",
+            slot->control.seq_no, slot->pkt->length);
+
+        _hdlc_write_slot(link, slot);
+        link->stats.tx_frames++;
+        slot->sent_at = link->rtt_time.read_us();
+        slot->retransmitted = false;
+        if (_frames_in_flight(link) == 0) {
+            /* the timer always runs for the oldest frame */
+            link->global_time.reset();
+        }
+        link->send_seq_no++;
+    }
+}
+
+/**
+ * Retransmission timeout: Go-Back-N from the oldest frame, backing off. A
+ * busy peer is only polled with the oldest frame, in case its RR was lost.
+ */
+static void _hdlc_resend(hdlc_link_t *link)
+{
+    if (link->peer_busy) {
+        _hdlc_resend_slot(link, &link->send_win[link->send_base % HDLC_WINDOW_SIZE]);
+        link->global_time.reset();
+    } else {
+        _hdlc_resend_window(link);
+    }
+    _rto_backoff(link);
+}
+
+/**
+ * The send of @p slot timed out, so its packet is the sender's again: copy
+ * the data into the slot, which resends it from there until it is ACKed.
+ */
+static void _hdlc_slot_keep(hdlc_send_slot_t *slot)
+{
+    hdlc_pkt_t *pkt = slot->pkt;
+    unsigned int len = 0, n;
+
+    if (pkt->data != NULL) {
+        len = pkt->length < HDLC_MAX_PKT_SIZE ? pkt->length : HDLC_MAX_PKT_SIZE;
+        memcpy(slot->kept_data, pkt->data, len);
+    } else {
+        for (unsigned int i = 0; i < pkt->iovcnt; i++) {
+            n = pkt->iov[i].len < HDLC_MAX_PKT_SIZE - len ? pkt->iov[i].len
+                                                          : HDLC_MAX_PKT_SIZE - len;
+            memcpy(slot->kept_data + len, pkt->iov[i].base, n);
+            len += n;
+        }
+    }
+    slot->kept.data = slot->kept_data;
+    slot->kept.length = len;
+    slot->kept.iov = NULL;
+    slot->kept.iovcnt = 0;
+    slot->pkt = &slot->kept;
+}
+
+/**
+ * Time out async sends whose timeout_ms has run out: one still queued is
+ * dropped, one in the window keeps a copy of its packet and stays there, to
+ * be resent if need be. Returns how many ms until the next one is due.
+ */
+static uint32_t _hdlc_send_expire(hdlc_link_t *link)
+{
+    hdlc_send_slot_t *slot;
+    hdlc_tx_queue_t *queue;
+    hdlc_tx_flow_t *flow, *tmp1, *tmp2;
+    hdlc_tx_req_t *req, *tmp;
+    hdlc_send_t *send;
+    uint32_t next = osWaitForever;
+    int now, left;
+
+    if (link->send_timeouts == 0) {
+        return next;
+    }
+    now = link->rtt_time.read_us();
+    for (unsigned int i = link->send_base; i != link->send_seq_no; i++) {
+        slot = &link->send_win[i % HDLC_WINDOW_SIZE];
+        send = slot->send;
+        if (send == NULL || send->timeout_ms == 0) {
+            continue;
+        }
+        left = send->expires_at - now;
+        if (left > 0) {
+            if ((uint32_t)(left + 999) / 1000 < next) {
+                next = (uint32_t)(left + 999) / 1000;
+            }
+            continue;
+        }
+        slot->send = NULL;
+        _hdlc_slot_keep(slot);
+        _hdlc_send_done(link, send, HDLC_SEND_TIMED_OUT);
+    }
+    for (int i = 0; i < HDLC_NUM_CLASSES; i++) {
+        queue = &link->tx_queue[i];
+        CDL_FOREACH_SAFE(queue->cur, flow, tmp1, tmp2) {
+            LL_FOREACH_SAFE(flow->reqs, req, tmp) {
+                send = req->send;
+                if (send == NULL || send->timeout_ms == 0) {
+                    continue;
+                }
+                left = send->expires_at - now;
+                if (left > 0) {
+                    if ((uint32_t)(left + 999) / 1000 < next) {
+                        next = (uint32_t)(left + 999) / 1000;
+                    }
+                    continue;
+                }
+                LL_DELETE(flow->reqs, req);
+                LL_PREPEND(queue->free_reqs, req);
+                queue->count--;
+                link->tx_queued--;
+                if (flow->reqs == NULL) {
+                    _hdlc_tx_flow_done(queue, flow);
+                }
+                _hdlc_send_done(link, send, HDLC_SEND_TIMED_OUT);
             }
-                                
-            recv_buf.control.frame = (yahdlc_frame_t)0;
-            recv_buf.control.seq_no = 0;
-            return;
         }
     }
+    return next;
 }
 
-static void _hdlc()
+/**
+ * Resend if the link's retransmission timer has expired. Returns how many ms
+ * the caller may sleep before the timer needs another look.
+ */
+static uint32_t _hdlc_timer(hdlc_link_t *link)
 {
-    msg_t *msg, *reply;
-    unsigned int recv_seq_no = 0;
-    unsigned int send_seq_no = 0;
-    osEvent evt;
+    int timeout;
+    uint32_t ack_timeout, busy_timeout = _hdlc_busy_timer(link);
+    uint32_t expire_timeout = _hdlc_send_expire(link);
 
-    while(1) {
+    if (expire_timeout < busy_timeout) {
+        busy_timeout = expire_timeout;
+    }
 
-        led2=!led2;
-        // hdlc_ready=1;
-        if(uart_lock) {
-            // int uart_ll=(int)uart_lock_time.read_us();
-            // if(uart_ll>10*RETRANSMIT_TIMEO_USEC)
-            // {
-            //     PRINTF("hdlc: UART is locked for %d us_seconds\n",uart_ll);
-            //     uart_lock=0;
-            //     goto getmail;
-            // }    
-            int timeout = (int)RETRANSMIT_TIMEO_USEC - (int) global_time.read_us();
-            if(timeout < 0) {
-                // PRINTF("hdlc: inside timeout negative\n");
-                /* send message to self to resend msg */
-                msg = hdlc_mailbox.alloc();
-                if(msg == NULL) {
-                    PRINTF("hdlc: no more space available on mailbox");
-                    /* service mailbox and try again */
-                    evt = hdlc_mailbox.get();
+    if (_frames_in_flight(link) == 0) {
+        ack_timeout = _hdlc_ack_timer(link);
+        return ack_timeout < busy_timeout ? ack_timeout : busy_timeout;
+    }
+    timeout = (int)link->rto_usec - (int) link->global_time.read_us();
+    if (timeout < 0) {
+        _hdlc_resend(link);
+        timeout = (int)link->rto_usec;
+    }
+    /* after any resend, which carries the ACK with it */
+    ack_timeout = _hdlc_ack_timer(link);
+    if (busy_timeout < ack_timeout) {
+        ack_timeout = busy_timeout;
+    }
+    if ((uint32_t)(timeout + 999) / 1000 < ack_timeout) {
+        return (uint32_t)(timeout + 999) / 1000;
+    }
+    return ack_timeout;
+}
+
+/**
+ * Send @p pkt as a UI frame right away, ahead of any queued data frames, and
+ * tell the sender its buffer is free again. Nothing is resent and nothing
+ * holds the sender back (a busy peer drops UI frames), so streams where a
+ * fresh sample beats a complete one should pace themselves.
+ */
+static void _hdlc_send_ui(hdlc_link_t *link, hdlc_pkt_t *pkt,
+                          Mail<msg_t, HDLC_MAILBOX_SIZE> *sender_mailbox)
+{
+    yahdlc_control_t control;
+    msg_t *reply;
+
+    control.frame = YAHDLC_FRAME_UI;
+    control.seq_no = control.recv_seq_no = 0;
+    PRINTF("hdlc: sending UI frame, len %d\n", pkt->length);
+    _hdlc_write_frame(link, &control, pkt);
+    link->stats.tx_datagrams++;
+
+    reply = sender_mailbox->alloc();
+    if (reply == NULL) {
+        PRINTF("hdlc: no space in sender mailbox for SND_SUCC\n");
+        return;
+    }
+    reply->sender_pid = osThreadGetId();
+    reply->type = HDLC_RESP_SND_SUCC;
+    reply->content.value = (uint32_t) 0;
+    reply->source_mailbox = &link->mailbox;
+    sender_mailbox->put(reply);
+}
+
+static void _hdlc_handle(hdlc_link_t *link, msg_t *msg)
+{
+    msg_t *reply;
+    hdlc_tx_queue_t *queue;
+    hdlc_tx_req_t *req;
+    hdlc_send_t *send;
+    hdlc_pkt_t *pkt;
+    uint16_t port;
+
+    switch (msg->type) {
+        case HDLC_MSG_RECV:
+            PRINTF("hdlc: receiving msg...\n");
+            /* rx_msg is reserved for rx_cb(), don't free it */
+            link->rx_pending = false;
+            _hdlc_receive(link);
+            break;
+        case HDLC_MSG_SND:
+        case HDLC_MSG_SND_ASYNC:
+            PRINTF("hdlc: request to send received from pid %d\n", msg->sender_pid);
+            send = msg->type == HDLC_MSG_SND_ASYNC ? (hdlc_send_t*)msg->content.ptr : NULL;
+            pkt = send ? send->pkt : (hdlc_pkt_t*)msg->content.ptr;
+            queue = &link->tx_queue[_hdlc_tx_class(link, pkt, &port)];
+            if (queue->count >= queue->depth && send != NULL) {
+                _hdlc_send_done(link, send, HDLC_SEND_REJECTED);
+            } else if (queue->count >= queue->depth) {
+                /* ask thread to try again in x usec */
+                PRINTF("hdlc: tx queue full, telling thr to retry\n");
+                reply=((Mail<msg_t, HDLC_MAILBOX_SIZE>*)msg->source_mailbox)->alloc();
+                if(reply == NULL) {
+                    PRINTF("hdlc: no space in thread mailbox. ERROR!!\n");
                 }
                 else {
-                    msg->sender_pid = osThreadGetId();
-                    msg->type = HDLC_MSG_RESEND;
-                    msg->source_mailbox = &hdlc_mailbox;
-                    hdlc_mailbox.put(msg); 
-                    evt = hdlc_mailbox.get();
+                    reply->type = HDLC_RESP_RETRY_W_TIMEO;
+                    reply->content.value = (uint32_t) RTRY_TIMEO_USEC;
+                    reply->sender_pid = osThreadGetId();
+                    ((Mail<msg_t, HDLC_MAILBOX_SIZE>*)msg->source_mailbox)->put(reply);
                 }
-
             } else {
-                evt = hdlc_mailbox.get(timeout / 1000);
-                if(evt.status == osEventTimeout){
-                    continue;
+                req = queue->free_reqs;
+                LL_DELETE(queue->free_reqs, req);
+                req->pkt = pkt;
+                req->send = send;
+                req->sender_pid = msg->sender_pid;
+                req->sender_mailbox = (Mail<msg_t, HDLC_MAILBOX_SIZE>*)msg->source_mailbox;
+                req->queued_at = link->rtt_time.read_us();
+                _hdlc_tx_enqueue(queue, port, req);
+                link->tx_queued++;
+                if (send != NULL && send->timeout_ms) {
+                    send->expires_at = req->queued_at + (int)send->timeout_ms * 1000;
+                    link->send_timeouts++;
                 }
             }
-        } else {
-            // PRINTF("hdlc: waiting for mail\n");
-  getmail:          evt = hdlc_mailbox.get();
-        }
-       
-        if (evt.status == osEventMail) 
-        {          
-            msg = (msg_t*)evt.value.p;
-
-            switch (msg->type) {
-                case HDLC_MSG_RECV:
-                    PRINTF("hdlc: receiving msg...\n");
-                    _hdlc_receive(&recv_seq_no, &send_seq_no);
-                    hdlc_mailbox.free(msg);
-                    break;
-                case HDLC_MSG_SND:
-                    PRINTF("hdlc: request to send received from pid %d\n", msg->sender_pid);
-                    if (uart_lock) {
-                        /* ask thread to try again in x usec */
-                        PRINTF("hdlc: uart locked, telling thr to retry\n");
-                        reply=((Mail<msg_t, HDLC_MAILBOX_SIZE>*)msg->source_mailbox)->alloc();
-                        if(reply == NULL) {
-                            PRINTF("hdlc: no space in thread mailbox. ERROR!!\n");
-                        }
-                        else {
-                            reply->type = HDLC_RESP_RETRY_W_TIMEO;
-                            reply->content.value = (uint32_t) RTRY_TIMEO_USEC;
-                            reply->sender_pid = osThreadGetId();
-                            ((Mail<msg_t, HDLC_MAILBOX_SIZE>*)msg->source_mailbox)->put(reply);
-                        }
-                    } else {
-                        uart_lock = 1;
-                        sender_pid = msg->sender_pid;
-                        PRINTF("hdlc: sender_pid set to %d\n", sender_pid);
-                        send_buf.control.frame = YAHDLC_FRAME_DATA;
-                        send_buf.control.seq_no = send_seq_no % 8; 
-                        hdlc_pkt_t *pkt = (hdlc_pkt_t*)msg->content.ptr;
-                        yahdlc_frame_data(&(send_buf.control), pkt->data, 
-                                pkt->length, send_buf.data, &send_buf.length);
-
-                        sender_mailbox_ptr=(Mail<msg_t, HDLC_MAILBOX_SIZE>*)msg->source_mailbox;
-                        PRINTF("hdlc: sending frame seq no %d, len %d\n", 
-                            send_buf.control.seq_no,send_buf.length);
-
-                        write_hdlc((uint8_t *)send_buf.data, send_buf.length);
-                        global_time.reset();
-                        uart_lock_time.reset();
-                    }  
-                    hdlc_mailbox.free(msg); 
-                    break;
-                case HDLC_MSG_SND_ACK:
-                    /* send ACK */
-                    ack_buf.control.frame = YAHDLC_FRAME_ACK;
-                    ack_buf.control.seq_no = msg->content.value;
-                    yahdlc_frame_data(&(ack_buf.control), NULL, 0, ack_buf.data, 
-                        &(ack_buf.length));    
-                    PRINTF("hdlc: sending ack w/ seq no %d, len %d\n", 
-                        ack_buf.control.seq_no,ack_buf.length);
-                    write_hdlc((uint8_t *)ack_buf.data, ack_buf.length);
-                    // uart2.write((uint8_t *)ack_buf.data, ack_buf.length,0,0);   
-                    hdlc_mailbox.free(msg);
-                    break;
-                case HDLC_MSG_RESEND:
-                    PRINTF("hdlc: Resending frame w/ seq no %d (on send_seq_no %d)\n", 
-                        send_buf.control.seq_no, send_seq_no);
-                    write_hdlc((uint8_t *)send_buf.data, send_buf.length);
-                    // uart2.write((uint8_t *)send_buf.data, send_buf.length,0,0);
-                    global_time.reset();
-                    hdlc_mailbox.free(msg); 
-                    break;
-                default:
-                    PRINTF("INVALID HDLC MSG\n");
-                    //LED3_ON;
-                    hdlc_mailbox.free(msg); 
-                    break;
+            link->mailbox.free(msg);
+            break;
+        case HDLC_MSG_RX_READY:
+            /* ready_msg is reserved for hdlc_pkt_release(), don't free it */
+            link->ready_pending = false;
+            if (link->rx_busy) {
+                _hdlc_busy_retry(link, false);
+            }
+            break;
+        case HDLC_MSG_SND_UI:
+            _hdlc_send_ui(link, (hdlc_pkt_t*)msg->content.ptr,
+                (Mail<msg_t, HDLC_MAILBOX_SIZE>*)msg->source_mailbox);
+            link->mailbox.free(msg);
+            break;
+        case HDLC_MSG_SND_ACK:
+            /* send ACK */
+            _hdlc_write_sframe(link, YAHDLC_FRAME_ACK, msg->content.value);
+            link->mailbox.free(msg);
+            break;
+        case HDLC_MSG_RESEND:
+            _hdlc_resend(link);
+            link->mailbox.free(msg);
+            break;
+        default:
+            PRINTF("INVALID HDLC MSG\n");
+            //LED3_ON;
+            link->mailbox.free(msg);
+            break;
+    }
+
+    /* an ACK or a new request may have made room in the window */
+    _hdlc_send_pending(link);
+}
+
+static void _hdlc_attach(hdlc_link_t *link)
+{
+    link->tid = osThreadGetId();
+    link->uart->attach(callback(rx_cb, link), SerialBase::RxIrq);
+    /* TxIrq only while the tx ring has bytes, see _tx_start() */
+}
+
+/* thread serving a single link: sleeps on its mailbox */
+static void _hdlc(hdlc_link_t *link)
+{
+    osEvent evt;
+
+    _hdlc_attach(link);
+    while(1) {
+        led2=!led2;
+        evt = link->mailbox.get(_hdlc_timer(link));
+        if (evt.status == osEventMail) {
+            _hdlc_handle(link, (msg_t*)evt.value.p);
+        }
+    }
+
+    /* this should never be reached */
+}
+
+/**
+ * Thread serving a chain of links: drains every mailbox, then sleeps on
+ * HDLC_SIG_WAKE until an rx interrupt or hdlc_link_post() has more for it
+ * or the earliest retransmission timer is due.
+ */
+static void _hdlc_shared(hdlc_link_t *links)
+{
+    hdlc_link_t *link;
+    uint32_t timeout, t;
+    osEvent evt;
+
+    for (link = links; link; link = link->next) {
+        _hdlc_attach(link);
+    }
+    while(1) {
+        led2=!led2;
+        timeout = osWaitForever;
+        for (link = links; link; link = link->next) {
+            while ((evt = link->mailbox.get(0)).status == osEventMail) {
+                _hdlc_handle(link, (msg_t*)evt.value.p);
+            }
+            t = _hdlc_timer(link);
+            if (t < timeout) {
+                timeout = t;
             }
         }
+        Thread::signal_wait(HDLC_SIG_WAKE, timeout);
     }
 
     /* this should never be reached */
 }
 
 /**
- * @brief Send @p pkt as an hdlc command packet over serial. This function blocks.
+ * @brief Submit @p send on @p link and return at once; the outcome shows in
+ *        send->status, and through send->done and send->thread if set.
+ * @param  link Link to send on.
+ * @param  send Handle filled in by the caller, see hdlc_send_t.
+ * @return      0, or -ENOMEM if the link's mailbox is full (nothing was sent).
+ */
+int hdlc_send_async(hdlc_link_t *link, hdlc_send_t *send)
+{
+    msg_t *msg = link->mailbox.alloc();
+
+    if (msg == NULL) {
+        return -ENOMEM;
+    }
+    send->status = HDLC_SEND_PENDING;
+    msg->type = HDLC_MSG_SND_ASYNC;
+    msg->content.ptr = send;
+    msg->sender_pid = osThreadGetId();
+    msg->source_mailbox = NULL;
+    hdlc_link_post(link, msg);
+    return 0;
+}
+
+/**
+ * @brief Send @p pkt as an hdlc command packet over serial and wait for the
+ *        peer's reply. This function blocks, for up to HDLC_COMMAND_TIMEO_MS
+ *        on the ACK and as long again on the reply; other packets that arrive
+ *        for the caller's port meanwhile are dropped. hdlc_rpc.h has calls
+ *        that can overlap and leave other packets alone.
  * @param  pkt            Packet to be sent.
  * @param  sender_mailbox Pointer to sender's mailbox.
- * @return                [description]
+ * @param  reply          Packet type of the expected reply.
+ * @return                1 if the reply came, 0 otherwise.
  */
 int hdlc_send_command(hdlc_pkt_t *pkt, Mail<msg_t, HDLC_MAILBOX_SIZE> *sender_mailbox, 
                                                     riot_to_mbed_t reply)
 {
-// /* TODO: should the second input not be a void pointer? */
-// /* TODO: limit the number of retries */
-    msg_t *msg, *msg2;
+    hdlc_send_t send;
     hdlc_buf_t *buf;
-    char recv_data_local[HDLC_MAX_PKT_SIZE];
     uart_pkt_hdr_t hdr;
-    // Timer       command_send_time;
-    /* send pkt */
-    msg = hdlc_mailbox.alloc();
-    msg->type = HDLC_MSG_SND;
-    msg->content.ptr = pkt;
-    msg->sender_pid = osThreadGetId();
-    msg->source_mailbox = sender_mailbox;
-    hdlc_mailbox.put(msg);
-    PRINTF("hdlc: in hdlc send command\n");
-    while(1)
-    {
-        osEvent evt = sender_mailbox->get(2000);
-        if(evt.status == osEventTimeout){
-                    return 0;
-        }
-            // if(uart_ll>10*RETRANSMIT_TIMEO_USEC)
-        if (evt.status == osEventMail) 
-        {
-            msg = (msg_t*)evt.value.p;
-
-            switch (msg->type)
-            {
-                case HDLC_RESP_SND_SUCC:
-                    PRINTF("sent frame_no!\n");
-                    sender_mailbox->free(msg);
-                    break;
-                case HDLC_RESP_RETRY_W_TIMEO:
-                    Thread::wait(msg->content.value/1000);
-                    msg2 = hdlc_mailbox.alloc();
-                    if (msg2 == NULL) {
-                        while(msg2 == NULL)
-                        {
-                            msg2 = sender_mailbox->alloc();  
-                            Thread::wait(10);
-                        }
-                        /* TODO: this doesn't seem right... */
-                        msg2->type = HDLC_RESP_RETRY_W_TIMEO;
-                        msg2->content.value = (uint32_t) RTRY_TIMEO_USEC;
-                        msg2->sender_pid = osThreadGetId();
-                        msg2->source_mailbox = sender_mailbox;
-                        sender_mailbox->put(msg2);
-                        sender_mailbox->free(msg);
-                        break;
-                    }
-                    msg2->type = HDLC_MSG_SND;
-                    msg2->content.ptr = pkt;
-                    msg2->sender_pid = osThreadGetId();
-                    msg2->source_mailbox = sender_mailbox;
-                    hdlc_mailbox.put(msg2);
-                    sender_mailbox->free(msg);
-                    break;
-                case HDLC_PKT_RDY: 
-                    buf = (hdlc_buf_t *)msg->content.ptr;   
-                    uart_pkt_parse_hdr(&hdr, (void *)buf->data, (size_t) (buf->length));
-                    hdlc_pkt_release(buf);
-                    sender_mailbox->free(msg);
-                    PRINTF("hdlc_send_command: received pkt\n");
-                    if (hdr.pkt_type == reply)
-                        return 1;
-                    else
-                        return 0;
-                    break;
-                default:
-                    sender_mailbox->free(msg);
-                    /* error */
-                    break;
+    Timer waited;
+    osEvent evt;
+    msg_t *msg;
+    int left;
+
+    memset(&send, 0, sizeof(send));
+    send.pkt = pkt;
+    send.timeout_ms = HDLC_COMMAND_TIMEO_MS;
+    send.thread = osThreadGetId();
+    send.signals = HDLC_SIG_SENT;
+    waited.start();
+    while (1) {
+        if (hdlc_send_async(&hdlc_link, &send) == 0) {
+            while (send.status == HDLC_SEND_PENDING) {
+                Thread::signal_wait(HDLC_SIG_SENT);
             }
-        }    
+            if (send.status != HDLC_SEND_REJECTED) {
+                break;
+            }
+        }
+        /* the link's mailbox or the class queue is full */
+        if (waited.read_ms() >= HDLC_COMMAND_TIMEO_MS) {
+            return 0;
+        }
+        Thread::wait(RTRY_TIMEO_USEC / 1000);
+    }
+    PRINTF("hdlc_send_command: sent, status %d\n", send.status);
+    if (send.status != HDLC_SEND_ACKED) {
+        return 0;
+    }
+
+    waited.reset();
+    while ((left = HDLC_COMMAND_TIMEO_MS - waited.read_ms()) > 0) {
+        evt = sender_mailbox->get(left);
+        if (evt.status != osEventMail) {
+            break;
+        }
+        msg = (msg_t*)evt.value.p;
+        if (msg->type != HDLC_PKT_RDY) {
+            sender_mailbox->free(msg);
+            continue;
+        }
+        buf = (hdlc_buf_t *)msg->content.ptr;
+        uart_pkt_parse_hdr(&hdr, (void *)buf->data, (size_t) (buf->length));
+        hdlc_pkt_release(buf);
+        sender_mailbox->free(msg);
+        PRINTF("hdlc_send_command: received pkt\n");
+        if (hdr.pkt_type == reply) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Make @p pkt the @p iovcnt pieces at @p iov, e.g. a uart_pkt_hdr_t
+ *        and the caller's own payload struct, so that it is framed without
+ *        first being copied together. Sets pkt->length to their total. The
+ *        pieces and @p iov are read on every resend, so they must not change
+ *        until the send is over (see hdlc_pkt_t).
+ * @return 0, or -EINVAL if they add up to more than HDLC_MAX_PKT_SIZE.
+ */
+int hdlc_pkt_iov(hdlc_pkt_t *pkt, const yahdlc_iovec_t *iov,
+                 unsigned int iovcnt)
+{
+    unsigned int length = 0;
+
+    for (unsigned int i = 0; i < iovcnt; i++) {
+        length += iov[i].len;
+    }
+    if (length > HDLC_MAX_PKT_SIZE) {
+        return -EINVAL;
     }
+    pkt->data = NULL;
+    pkt->length = length;
+    pkt->iov = iov;
+    pkt->iovcnt = iovcnt;
+    return 0;
 }
 
+/**
+ * @brief uart_pkt_parse_hdr() for a packet about to be sent, whole or in
+ *        pieces (the header may straddle them).
+ * @return 0, or -1 if @p pkt is shorter than a header.
+ */
+int hdlc_pkt_parse_hdr(uart_pkt_hdr_t *hdr, const hdlc_pkt_t *pkt)
+{
+    char raw[UART_PKT_HDR_LEN];
+    unsigned int got = 0, n;
+
+    if (pkt->data != NULL) {
+        return uart_pkt_parse_hdr(hdr, pkt->data, pkt->length);
+    }
+    for (unsigned int i = 0; i < pkt->iovcnt && got < sizeof(raw); i++) {
+        n = pkt->iov[i].len < sizeof(raw) - got ? pkt->iov[i].len
+                                                : sizeof(raw) - got;
+        memcpy(raw + got, pkt->iov[i].base, n);
+        got += n;
+    }
+    return uart_pkt_parse_hdr(hdr, raw, got);
+}
+
+/**
+ * @brief Take another reference to a buffer received in an HDLC_PKT_RDY
+ *        message, e.g. before passing it on to a second thread. Every
+ *        reference is dropped with its own hdlc_pkt_release().
+ * @param  buf  Buffer from the message's content.ptr.
+ */
+void hdlc_pkt_hold(hdlc_buf_t *buf)
+{
+    if (!_hdlc_rx_owned(buf)) {
+        PRINTF("hdlc: not a receive buffer!\n");
+        return;
+    }
+    core_util_critical_section_enter();
+    ((hdlc_rx_buf_t *)buf)->refs++;
+    core_util_critical_section_exit();
+}
+
+/**
+ * @brief Drop a reference to a buffer received in an HDLC_PKT_RDY message;
+ *        the last one returns it to the pool.
+ * @param  buf  Buffer from the message's content.ptr.
+ * @return      0 on success, -1 if @p buf is not a receive buffer or is
+ *              not held.
+ */
 int hdlc_pkt_release(hdlc_buf_t *buf) 
 {
-    if(recv_buf_cpy_mutex.wait(0))
-    {
-        PRINTF("hdlc: Packet not locked. Might be empty!\n");
-        recv_buf_cpy_mutex.release();
+    hdlc_rx_buf_t *rx_buf = (hdlc_rx_buf_t *)buf;
+    hdlc_link_t *link;
+    int refs;
+    bool wakeup;
+
+    if (!_hdlc_rx_owned(buf)) {
+        PRINTF("hdlc: not a receive buffer!\n");
         return -1;
     }
-    else
-    {
-        buf->control.frame = (yahdlc_frame_t)0;
-        buf->control.seq_no = 0;
-        PRINTF("hdlc: relesed lock!\n");
-
-        recv_buf_cpy_mutex.release();
+    core_util_critical_section_enter();
+    refs = rx_buf->refs > 0 ? (int)--rx_buf->refs : -1;
+    core_util_critical_section_exit();
+    if (refs < 0) {
+        PRINTF("hdlc: receive buffer released twice!\n");
+        return -1;
+    }
+    if (refs > 0) {
         return 0;
     }
+    link = rx_buf->link;
+    buf->control.frame = (yahdlc_frame_t)0;
+    buf->control.seq_no = 0;
+    _hdlc_rx_free(rx_buf);
+    PRINTF("hdlc: released rx buffer\n");
 
+    /* a busy link may deliver now; port threads can race to wake it */
+    core_util_critical_section_enter();
+    wakeup = link->rx_busy && !link->ready_pending;
+    if (wakeup) {
+        link->ready_pending = true;
+    }
+    core_util_critical_section_exit();
+    if (wakeup) {
+        hdlc_link_post(link, link->ready_msg);
+    }
+    return 0;
 }
 
 
+Mail<msg_t, HDLC_MAILBOX_SIZE> *hdlc_link_mailbox(hdlc_link_t *link)
+{
+    return &link->mailbox;
+}
+
 Mail<msg_t, HDLC_MAILBOX_SIZE> *get_hdlc_mailbox()
 {
-    return &hdlc_mailbox;
+    return &hdlc_link.mailbox;
+}
+
+/* the link hdlc_init() sets up, for the hdlc_link_* and hdlc_send_async() calls */
+hdlc_link_t *get_hdlc_link()
+{
+    return &hdlc_link;
 }
 
-void write_hdlc(uint8_t *ptr,int len)
+/* called from the isr whenever it frees ring space */
+static void _tx_notify(hdlc_link_t *link)
+{
+    if (link->tx_waiting && link->tx_head - link->tx_tail <= HDLC_TX_RING_SIZE / 2) {
+        link->tx_waiting = false;
+        link->tx_space.release();
+    }
+}
+
+static void tx_cb(hdlc_link_t *link)
+{
+    while (link->uart->writeable()) {
+        if (link->tx_head == link->tx_tail) {
+            /* idle; detached, as a level triggered tx-empty interrupt would
+             * fire again at once, until _tx_start() restarts it */
+            link->uart->attach(NULL, SerialBase::TxIrq);
+            link->tx_busy = false;
+            break;
+        }
+        link->uart->putc(link->tx_ring[link->tx_tail % HDLC_TX_RING_SIZE]);
+        link->tx_tail++;
+    }
+    _tx_notify(link);
+}
+
+/**
+ * Hand the ring to the transmitter if it is idle: fill it by hand, then let
+ * its tx-empty interrupt send the rest (the BufferedSerial way). RawSerial
+ * can attach from the interrupt too, where tx_cb() detaches.
+ */
+static void _tx_start(hdlc_link_t *link)
+{
+    core_util_critical_section_enter();
+    if (!link->tx_busy && link->tx_head != link->tx_tail) {
+        link->tx_busy = true;
+        tx_cb(link);
+        if (link->tx_busy) {
+            link->uart->attach(callback(tx_cb, link), SerialBase::TxIrq);
+        }
+    }
+    core_util_critical_section_exit();
+}
+
+/**
+ * @brief Encode a frame straight into @p link's tx ring, as much as fits at
+ *        a time, starting the transmitter on each piece so the first bytes
+ *        go out while the rest is encoded. Returns once it is all in the
+ *        ring, sleeping (not spinning) while the ring is full.
+ * @param  pkt  Data of a DATA or UI frame, whole or in pieces; NULL for none.
+ * @return      Length of the frame on the wire.
+ */
+static unsigned int _hdlc_write_frame(hdlc_link_t *link,
+                                      yahdlc_control_t *control,
+                                      hdlc_pkt_t *pkt)
 {
-    int count = 0;
+    yahdlc_encoder_t enc;
+    yahdlc_iovec_t whole;
+    unsigned int head, room, n, len = 0;
 
-    while ( count < len ) {
-        if (uart2.writeable()) {
-            uart2.putc(ptr[count]);   
-            count++;
+    if (pkt == NULL) {
+        yahdlc_encode_init(&enc, control, NULL, 0);
+    } else if (pkt->data != NULL) {
+        whole.base = pkt->data;
+        whole.len = pkt->length;
+        yahdlc_encode_init(&enc, control, &whole, 1);
+    } else {
+        yahdlc_encode_init(&enc, control, pkt->iov, pkt->iovcnt);
+    }
+
+    while (1) {
+        /* free space up to the tail or the end of the ring */
+        head = link->tx_head % HDLC_TX_RING_SIZE;
+        room = HDLC_TX_RING_SIZE - (link->tx_head - link->tx_tail);
+        if (room > HDLC_TX_RING_SIZE - head) {
+            room = HDLC_TX_RING_SIZE - head;
+        }
+        n = yahdlc_encode(&enc, &link->tx_ring[head], room);
+        link->tx_head += n;
+        len += n;
+        _tx_start(link);
+        if (yahdlc_encode_done(&enc)) {
+            return len;
+        }
+
+        link->tx_waiting = true;
+        if (link->tx_head - link->tx_tail == HDLC_TX_RING_SIZE) {
+            link->tx_space.wait();
         }
     }
 }
+
 void buffer_cpy(hdlc_buf_t* dst, hdlc_buf_t* src)
 {
-    memcpy(dst->data,src->data,HDLC_MAX_PKT_SIZE);
+    memcpy(dst->data,src->data,src->length);
     memcpy(&dst->control,&src->control,sizeof(yahdlc_control_t));
     dst->length=src->length;
 }
 
-Mail<msg_t, HDLC_MAILBOX_SIZE> *hdlc_init(osPriority priority) 
+/**
+ * @brief Set up @p link to run over @p uart. Call once, before
+ *        hdlc_link_start() or hdlc_links_start().
+ */
+void hdlc_link_init(hdlc_link_t *link, RawSerial *uart)
+{
+    link->uart = uart;
+    memset(link->ports, 0, sizeof(link->ports));
+    link->num_ports = 0;
+    link->ports_moved = 0;
+    link->tid = NULL;
+    link->next = NULL;
+    link->shared = false;
+
+    link->rx_head = link->rx_tail = 0;
+    link->rx_pending = false;
+    yahdlc_get_data_reset_with_state(&link->rx_state);
+    link->rx_loan = NULL;
+    link->recv_buf.data = link->recv_data;
+    link->recv_seq_no = 0;
+#if HDLC_SREJ
+    link->ooo_held = link->srej_sent = 0;
+#endif
+    link->rej_sent = false;
+    link->rx_busy = link->peer_busy = false;
+    link->busy_buf.data = link->busy_data;
+    link->ready_pending = false;
+    link->ack_owed = 0;
+    link->ack_now = false;
+    link->ack_every = HDLC_ACK_EVERY;
+    link->ack_delay_usec = HDLC_ACK_DELAY_USEC;
+
+    link->tx_head = link->tx_tail = 0;
+    link->tx_busy = link->tx_waiting = false;
+
+    link->send_base = link->send_seq_no = 0;
+    for (int i = 0; i < HDLC_NUM_CLASSES; i++) {
+        hdlc_tx_queue_t *queue = &link->tx_queue[i];
+
+        queue->free_reqs = NULL;
+        queue->free_flows = NULL;
+        for (int k = 0; k < HDLC_TX_QUEUE_SIZE; k++) {
+            LL_PREPEND(queue->free_reqs, &queue->req[k]);
+            LL_PREPEND(queue->free_flows, &queue->flow[k]);
+        }
+        queue->cur = NULL;
+        queue->count = 0;
+        queue->depth = HDLC_TX_QUEUE_SIZE;
+    }
+    link->tx_queue[HDLC_CLASS_CONTROL].depth = HDLC_TX_DEPTH_CONTROL;
+    link->tx_queued = 0;
+    link->send_timeouts = 0;
+
+    link->srtt_x8 = link->rttvar_x4 = 0;
+    link->rto_usec = RETRANSMIT_TIMEO_USEC;
+    memset(&link->stats, 0, sizeof(link->stats));
+
+    link->rx_msg = link->mailbox.alloc();
+    link->rx_msg->sender_pid = osThreadGetId();
+    link->rx_msg->type = HDLC_MSG_RECV;
+    link->rx_msg->source_mailbox = &link->mailbox;
+    link->ready_msg = link->mailbox.alloc();
+    link->ready_msg->sender_pid = osThreadGetId();
+    link->ready_msg->type = HDLC_MSG_RX_READY;
+    link->ready_msg->source_mailbox = &link->mailbox;
+    link->global_time.start();
+    link->rtt_time.start();
+    link->ack_time.start();
+}
+
+/**
+ * @brief Serve @p link from @p thread, which must not have been started.
+ * @return The link's mailbox.
+ */
+Mail<msg_t, HDLC_MAILBOX_SIZE> *hdlc_link_start(hdlc_link_t *link, Thread *thread)
+{
+    thread->start(callback(_hdlc, link));
+    return &link->mailbox;
+}
+
+/**
+ * @brief Serve @p num links from the one @p thread, which must not have been
+ *        started. Send requests to them with hdlc_link_post().
+ */
+void hdlc_links_start(hdlc_link_t **links, unsigned int num, Thread *thread)
+{
+    for (unsigned int i = 0; i < num; i++) {
+        links[i]->shared = true;
+        links[i]->next = i + 1 < num ? links[i + 1] : NULL;
+    }
+    thread->start(callback(_hdlc_shared, links[0]));
+}
+
+Mail<msg_t, HDLC_MAILBOX_SIZE> *hdlc_init(osPriority priority)
 {
     led2 = 1;
-    recv_buf.data = hdlc_recv_data;
-    recv_buf_cpy.data= hdlc_recv_data_cpy;
-    send_buf.data = hdlc_send_frame;
-    ack_buf.data = hdlc_ack_frame;
-    global_time.start();
-    uart_lock_time.start();
-    uart2.attach(&rx_cb,Serial::RxIrq);
+    hdlc_link_init(&hdlc_link, &uart2);
     hdlc.set_priority(priority);
-    hdlc.start(_hdlc);
+    hdlc_link_start(&hdlc_link, &hdlc);
     PRINTF("hdlc: thread  id %d\n",hdlc.gettid());
-    return &hdlc_mailbox;
+    return &hdlc_link.mailbox;
 }
-
@@ -41,8 +41,9 @@
  * @file
  * @brief       Full duplex hdlc implementation.
  *
- * This implementation leverages yahdlc, an open source library. The current 
- * implementation is stop & wait.
+ * This implementation leverages yahdlc, an open source library. Data frames
+ * are sent with a Go-Back-N sliding window of HDLC_WINDOW_SIZE frames and
+ * acknowledged cumulatively; a window of 1 is the original stop & wait.
  *
  * @author      Jason A. Tran <jasontra@usc.edu>
  *
@@ -58,10 +59,145 @@
 #include "uart_pkt.h"
 
 #define RTRY_TIMEO_USEC         100000
-#define RETRANSMIT_TIMEO_USEC   50000
+#define RETRANSMIT_TIMEO_USEC   50000   /* initial RTO, before any RTT sample */
+
+/* hdlc_send_command() waits this long for the ACK, then as long for the reply */
+#ifndef HDLC_COMMAND_TIMEO_MS
+#define HDLC_COMMAND_TIMEO_MS   2000
+#endif
+
+/**
+ * HDLC_MSG_SND requests that find the window full wait inside the hdlc thread
+ * in one queue per transmit class (see hdlc_entry_t.tx_class) of up to this
+ * many, shared fairly between source ports (see hdlc_tx_queue_t); only when
+ * its class is full is the sender told to retry after RTRY_TIMEO_USEC. The
+ * control queue is shorter, which bounds how long a command can queue behind
+ * other commands; hdlc_link_set_class_depth() changes any of them. The window
+ * is refilled from the highest class unless a request of a lower one has
+ * waited HDLC_TX_AGING_USEC.
+ */
+#ifndef HDLC_TX_QUEUE_SIZE
+#define HDLC_TX_QUEUE_SIZE      8
+#endif
+#ifndef HDLC_TX_DEPTH_CONTROL
+#define HDLC_TX_DEPTH_CONTROL   4
+#endif
+#ifndef HDLC_TX_AGING_USEC
+#define HDLC_TX_AGING_USEC      100000
+#endif
+
+/**
+ * Received packets are decoded straight into buffers from a pool of this many
+ * and handed to port threads by reference; each is held until the last
+ * hdlc_pkt_release(), see hdlc_pkt_hold().
+ */
+#ifndef HDLC_RX_POOL_SIZE
+#define HDLC_RX_POOL_SIZE       4
+#endif
+
+/**
+ * Set to 0 to decode into the link's recv_buf and copy each delivered frame
+ * into a pool buffer instead, the way it was done before loaned buffers; for
+ * comparing the two (host/hdlc_rx_bench).
+ */
+#ifndef HDLC_RX_LOAN
+#define HDLC_RX_LOAN            1
+#endif
+
+/* bytes buffered between the hdlc thread and the UART; powers of two */
+#ifndef HDLC_TX_RING_SIZE
+#define HDLC_TX_RING_SIZE       256
+#endif
+#ifndef HDLC_RX_RING_SIZE
+#define HDLC_RX_RING_SIZE       512
+#endif
+
+/* clamps for the adaptive retransmission timeout */
+#ifndef HDLC_RTO_MIN_USEC
+#define HDLC_RTO_MIN_USEC       5000
+#endif
+#ifndef HDLC_RTO_MAX_USEC
+#define HDLC_RTO_MAX_USEC       2000000
+#endif
 #define HDLC_MAX_PKT_SIZE       64
 #define HDLC_MAILBOX_SIZE       100
 
+/**
+ * Slots in each link's port dispatch table, a power of two. At most 3/4 of
+ * them can be registered so that lookups stay a probe or two.
+ */
+#ifndef HDLC_PORT_TABLE_SIZE
+#define HDLC_PORT_TABLE_SIZE    64
+#endif
+
+/* max unacknowledged data frames in flight; 1..7 (3 bit sequence numbers) */
+#ifndef HDLC_WINDOW_SIZE
+#define HDLC_WINDOW_SIZE        4
+#endif
+
+/**
+ * Protocol extensions, each off by default because a peer running the
+ * original stop & wait code misreads them or pays for them: it sends N(R) = 0
+ * in every data frame, takes a REJ or SREJ for an ACK of its sequence number,
+ * does not know RNR, and with one frame out at a time waits out every
+ * delayed ACK. Turn them on only when both ends of the link run this code,
+ * and then with the same settings on both.
+ *
+ * With HDLC_PIGGYBACK_ACKS the N(R) of every outgoing data frame acknowledges
+ * what has arrived in order.
+ */
+#ifndef HDLC_PIGGYBACK_ACKS
+#define HDLC_PIGGYBACK_ACKS     0
+#endif
+
+/**
+ * Delayed ACKs: frames accepted in order are acknowledged by one cumulative
+ * ACK frame once HDLC_ACK_EVERY of them are owed or HDLC_ACK_DELAY_USEC after
+ * the first, whichever comes first, unless a data frame carries the ACK
+ * sooner. The default of 1 frame and 0 usec ACKs every frame as it arrives;
+ * between two ends running this code, (HDLC_WINDOW_SIZE + 1) / 2 frames and
+ * 2000 usec halve the ACK frames. Per link values can be set with
+ * hdlc_link_set_ack_policy(). A run of duplicate or out of order frames gets
+ * one re-ACK either way.
+ */
+#ifndef HDLC_ACK_EVERY
+#define HDLC_ACK_EVERY          1
+#endif
+#ifndef HDLC_ACK_DELAY_USEC
+#define HDLC_ACK_DELAY_USEC     0
+#endif
+
+/**
+ * With HDLC_REJ a gap in the received sequence, or an FCS error, is answered
+ * at once by one REJ that asks for everything from the first missing frame;
+ * without it the gap gets a re-ACK and the peer's retransmit timer does the
+ * rest. With HDLC_SREJ as well, the frames after a gap are held and each
+ * missing one is asked for with an SREJ. Holding frames needs a window of at
+ * most 4 with 3 bit sequence numbers.
+ */
+#ifndef HDLC_SREJ
+#define HDLC_SREJ               0
+#endif
+#ifndef HDLC_REJ
+#define HDLC_REJ                HDLC_SREJ
+#endif
+
+/**
+ * A data frame that finds the rx pool or its port's mailbox full is kept
+ * until it can be delivered. With HDLC_RNR the peer is told RNR (receive not
+ * ready) meanwhile, and the RR that ends the busy spell lets it carry on;
+ * without it the peer is only re-ACKed the frames before it and resends it
+ * when its retransmit timer runs out.
+ * Delivery is retried when a buffer is released and every
+ * HDLC_BUSY_POLL_USEC (port threads free their mail without telling us).
+ */
+#ifndef HDLC_RNR
+#define HDLC_RNR                0
+#endif
+#ifndef HDLC_BUSY_POLL_USEC
+#define HDLC_BUSY_POLL_USEC     5000
+#endif
+
 typedef struct {
     yahdlc_control_t control;
     char *data;
@@ -78,36 +214,268 @@ typedef struct {
     } content;                  /**< Content of the message. */
 } msg_t;
 
-/* struct for other threads to pass to hdlc thread via IPC */
+/**
+ * struct for other threads to pass to hdlc thread via IPC. A packet whose
+ * data is NULL is the iovcnt pieces at iov instead, header first, framed
+ * from where they are; set it up with hdlc_pkt_iov().
+ *
+ * The packet stays the sender's memory while it is sent: each frame, and
+ * every resend of it, is encoded from data (or the pieces) as it is then,
+ * where the original stack copied the packet once it took the request. So
+ * the packet, what it points to and the iovec array must be left alone
+ * until the send is over: HDLC_RESP_SND_SUCC for HDLC_MSG_SND and
+ * HDLC_MSG_SND_UI, a status other than HDLC_SEND_PENDING for
+ * hdlc_send_async(). HDLC_RESP_RETRY_W_TIMEO hands it back unsent.
+ */
 typedef struct {
     char *data;
     unsigned int length;
+    const yahdlc_iovec_t *iov;  /* only read if data is NULL */
+    unsigned int iovcnt;
 } hdlc_pkt_t;
 
 /* HDLC thread messages */
 enum {
     HDLC_MSG_REG_DISPATCHER,
     HDLC_MSG_RECV,
-    HDLC_MSG_SND,
+    HDLC_MSG_SND,       /* content.ptr is an hdlc_pkt_t, read until SND_SUCC */
     HDLC_MSG_RESEND,
     HDLC_MSG_SND_ACK,
     HDLC_RESP_RETRY_W_TIMEO,
     HDLC_RESP_SND_SUCC,
-    HDLC_PKT_RDY
+    HDLC_PKT_RDY,
+    HDLC_MSG_RX_READY,
+    HDLC_MSG_SND_UI,    /* as HDLC_MSG_SND in a UI frame: never ACKed or resent */
+    HDLC_MSG_SND_ASYNC  /* content.ptr is an hdlc_send_t, see hdlc_send_async() */
 };
-typedef struct hdlc_entry {
-    struct hdlc_entry *next;
+/* transmit classes; a zeroed hdlc_entry_t is HDLC_CLASS_NORMAL */
+enum {
+    HDLC_CLASS_NORMAL,
+    HDLC_CLASS_CONTROL,         /* served first: commands, ranging */
+    HDLC_CLASS_BULK,            /* served last: logs, bulk transfers */
+    HDLC_NUM_CLASSES
+};
+
+typedef struct {
     uint16_t port;
     Mail<msg_t, HDLC_MAILBOX_SIZE> *mailbox;
+    uint8_t tx_class;           /* HDLC_CLASS_* of packets sent from port */
 } hdlc_entry_t;
 
+/* per-link counters, see hdlc_get_stats() */
+typedef struct {
+    uint32_t tx_frames;         /**< data frames sent, not counting resends */
+    uint32_t tx_resent;         /**< data frames sent again after a timeout */
+    uint32_t tx_datagrams;      /**< UI frames sent */
+    uint32_t tx_aged;           /**< sent early by HDLC_TX_AGING_USEC */
+    uint32_t tx_acks;           /**< ACK frames sent */
+    uint32_t rx_frames;         /**< in-order data frames accepted */
+    uint32_t rx_datagrams;      /**< UI frames delivered */
+    uint32_t tx_rejects;        /**< REJ and SREJ frames sent */
+    uint32_t tx_rnrs;           /**< RNR frames sent, see HDLC_BUSY_POLL_USEC */
+    uint32_t rx_acks;           /**< ACK frames received */
+    uint32_t rx_rejects;        /**< REJ and SREJ frames received */
+    uint32_t rx_rnrs;           /**< RNR frames received */
+    uint32_t rx_out_of_seq;     /**< duplicate or out of order data frames */
+    uint32_t rx_errors;         /**< FCS errors, short or oversized frames */
+    uint32_t rx_dropped;        /**< no port registered, or UI and no rx buffer */
+    uint32_t rx_overruns;       /**< bytes lost to a full rx ring */
+} hdlc_link_stats_t;
+
+/** how an hdlc_send_async() request ended, see hdlc_send_t */
+typedef enum {
+    HDLC_SEND_PENDING,          /**< queued or in the window */
+    HDLC_SEND_ACKED,            /**< acknowledged by the peer */
+    HDLC_SEND_TIMED_OUT,        /**< not acknowledged within timeout_ms */
+    HDLC_SEND_REJECTED          /**< its class queue was full; submit it again */
+} hdlc_send_status_t;
+
+/**
+ * A send submitted with hdlc_send_async(), owned by the caller like
+ * hdlc_entry_t, so one thread can keep as many in flight as it has handles.
+ * Set pkt and whichever way of hearing back suits, submit it, and leave it
+ * and the packet alone while status is HDLC_SEND_PENDING. On completion the
+ * hdlc thread sets status, then calls done() and signals thread; done() runs
+ * on the hdlc thread, so it must not block, but it may submit again. A frame
+ * that times out in the window has its data copied first and is resent from
+ * the copy until it is acknowledged; the peer may get it all the same.
+ */
+typedef struct hdlc_send {
+    hdlc_pkt_t *pkt;
+    uint32_t timeout_ms;        /**< 0 waits for the ACK however long it takes */
+    void (*done)(struct hdlc_send *send);   /**< if set */
+    void *arg;                  /**< for done() */
+    osThreadId thread;          /**< if set, gets signals on completion */
+    int32_t signals;
+    volatile hdlc_send_status_t status;
+    int expires_at;             /* rtt_time.read_us(), private to hdlc.cpp */
+} hdlc_send_t;
+
+/* one slot per unacknowledged frame, indexed by seq no % HDLC_WINDOW_SIZE */
+typedef struct {
+    yahdlc_control_t control;
+    hdlc_pkt_t *pkt;        /* encoded on every (re)send with the current N(R) */
+    hdlc_send_t *send;      /* or the sender below, from HDLC_MSG_SND */
+    osThreadId sender_pid;
+    Mail<msg_t, HDLC_MAILBOX_SIZE> *sender_mailbox;
+    int sent_at;            /* rtt_time.read_us() at first transmission */
+    bool retransmitted;     /* Karn: no RTT sample from resent frames */
+    hdlc_pkt_t kept;        /* pkt once its send timed out in the window */
+    char kept_data[HDLC_MAX_PKT_SIZE];
+} hdlc_send_slot_t;
+
+/* a send request waiting for a free window slot */
+typedef struct hdlc_tx_req {
+    struct hdlc_tx_req *next;
+    hdlc_pkt_t *pkt;
+    hdlc_send_t *send;
+    osThreadId sender_pid;
+    Mail<msg_t, HDLC_MAILBOX_SIZE> *sender_mailbox;
+    int queued_at;          /* rtt_time.read_us(), for aging */
+} hdlc_tx_req_t;
+
+/* the requests waiting from one source port, oldest first */
+typedef struct hdlc_tx_flow {
+    struct hdlc_tx_flow *next, *prev;
+    uint16_t port;
+    hdlc_tx_req_t *reqs;
+    int deficit;            /* bytes it may still send this round */
+} hdlc_tx_flow_t;
+
+/**
+ * The requests of one transmit class, one FIFO per source port, served
+ * deficit round robin by bytes so that every port gets an equal share of
+ * the class whatever its packet sizes or how many requests it keeps queued.
+ * A port only has a flow while it has requests waiting, so HDLC_TX_QUEUE_SIZE
+ * of each is enough.
+ */
+typedef struct {
+    hdlc_tx_req_t req[HDLC_TX_QUEUE_SIZE];
+    hdlc_tx_flow_t flow[HDLC_TX_QUEUE_SIZE];
+    hdlc_tx_req_t *free_reqs;
+    hdlc_tx_flow_t *free_flows;
+    hdlc_tx_flow_t *cur;    /* ring of flows, from the one being served */
+    unsigned int count;
+    unsigned int depth;     /* at most this many, see hdlc_link_set_class_depth() */
+} hdlc_tx_queue_t;
+
+/* signal that wakes a thread serving several links, see hdlc_links_start() */
+#define HDLC_SIG_WAKE           0x1
+/* signal hdlc_send_command() waits on, on the calling thread */
+#define HDLC_SIG_SENT           0x2
+
+/**
+ * Everything one hdlc link needs: its UART, mailbox and port registry, the
+ * decoder state, both byte rings, the frame buffers, the Go-Back-N window,
+ * the RTO estimator and the counters. Nothing in here is shared with another
+ * link, so the decode path needs no locks. Set up with hdlc_link_init(); the
+ * fields are private to hdlc.cpp.
+ */
+typedef struct hdlc_link {
+    RawSerial *uart;
+    Mail<msg_t, HDLC_MAILBOX_SIZE> mailbox;
+    hdlc_entry_t *ports[HDLC_PORT_TABLE_SIZE];  /* open addressing by port */
+    unsigned int num_ports;     /* slots in use, counting tombstones */
+    volatile unsigned int ports_moved;  /* odd while the table is rebuilt */
+    osThreadId tid;             /* thread serving the link */
+    struct hdlc_link *next;     /* next link served by the same thread */
+    bool shared;                /* that thread waits on HDLC_SIG_WAKE */
+
+    /* receive ring: head moved by the rx ISR, tail by the hdlc thread */
+    char rx_ring[HDLC_RX_RING_SIZE];
+    volatile unsigned int rx_head, rx_tail;
+    msg_t *rx_msg;              /* reserved wakeup, posted by the rx ISR */
+    volatile bool rx_pending;
+    yahdlc_state_t rx_state;
+    struct hdlc_rx_buf *rx_loan;    /* pool buffer the decoder writes into */
+    hdlc_buf_t recv_buf;            /* or this, while the pool is empty */
+    char recv_data[HDLC_MAX_PKT_SIZE + 2];  /* the decoder adds the FCS */
+    unsigned int recv_seq_no;
+#if HDLC_SREJ
+    /* frames held after a gap, by (absolute) seq no % HDLC_WINDOW_SIZE */
+    hdlc_buf_t ooo_buf[HDLC_WINDOW_SIZE];
+    char ooo_data[HDLC_WINDOW_SIZE][HDLC_MAX_PKT_SIZE + 2];
+    uint8_t ooo_held, srej_sent;    /* one bit per ooo_buf slot */
+#endif
+    bool rej_sent;              /* REJ for recv_seq_no is out */
+    bool rx_busy;               /* RNR: busy_buf waits for an rx buffer */
+    hdlc_buf_t busy_buf;        /* frame recv_seq_no, not yet delivered */
+    char busy_data[HDLC_MAX_PKT_SIZE + 2];
+    int busy_polled_at;         /* rtt_time.read_us() of the last attempt */
+    msg_t *ready_msg;           /* reserved wakeup, see hdlc_pkt_release() */
+    volatile bool ready_pending;
+    bool peer_busy;             /* the peer sent RNR: no new frames */
+    unsigned int ack_owed;      /* frames accepted since our last ACK */
+    bool ack_now;               /* a duplicate wants its re-ACK */
+    Timer ack_time;             /* age of the oldest of them */
+    unsigned int ack_every;     /* ACK policy, see HDLC_ACK_EVERY */
+    uint32_t ack_delay_usec;
+
+    /* transmit ring: head moved by the hdlc thread, tail by the tx ISR */
+    char tx_ring[HDLC_TX_RING_SIZE];
+    volatile unsigned int tx_head, tx_tail;
+    volatile bool tx_busy, tx_waiting;
+    Semaphore tx_space;
+
+    /* frames are encoded straight into tx_ring, see _hdlc_write_frame() */
+    hdlc_send_slot_t send_win[HDLC_WINDOW_SIZE];
+    unsigned int send_base;     /* oldest unacknowledged seq no (mod 2^32) */
+    unsigned int send_seq_no;   /* next unused seq no (mod 2^32) */
+
+    hdlc_tx_queue_t tx_queue[HDLC_NUM_CLASSES];
+    unsigned int tx_queued;     /* requests in all of them */
+    unsigned int send_timeouts; /* hdlc_send_t pending with a timeout_ms */
+
+    /* Jacobson/Karels estimator, see _rto_sample() */
+    uint32_t srtt_x8, rttvar_x4, rto_usec;
+    Timer global_time;          /* age of the oldest unacknowledged frame */
+    Timer rtt_time;
+
+    hdlc_link_stats_t stats;
+} hdlc_link_t;
+
 
 int hdlc_pkt_release(hdlc_buf_t *buf);
+void hdlc_pkt_hold(hdlc_buf_t *buf);
+int hdlc_pkt_iov(hdlc_pkt_t *pkt, const yahdlc_iovec_t *iov,
+                 unsigned int iovcnt);
+int hdlc_pkt_parse_hdr(uart_pkt_hdr_t *hdr, const hdlc_pkt_t *pkt);
 Mail<msg_t, HDLC_MAILBOX_SIZE> *hdlc_init(osPriority priority);
 Mail<msg_t, HDLC_MAILBOX_SIZE> *get_hdlc_mailbox();
+hdlc_link_t *get_hdlc_link();
 void buffer_cpy(hdlc_buf_t* dst, hdlc_buf_t* src);
-void hdlc_register(hdlc_entry_t *entry);
+int hdlc_register(hdlc_entry_t *entry);
 void hdlc_unregister(hdlc_entry_t *entry);
+uint32_t hdlc_get_rto_usec(void);
+uint32_t hdlc_get_srtt_usec(void);
+void hdlc_get_stats(hdlc_link_stats_t *stats);
+
+/**
+ * Links beyond the one hdlc_init() sets up on p28/p27. Initialise each with
+ * the RawSerial it owns (the link writes to it from its tx interrupt and in
+ * critical sections, where Serial's mutex is not allowed), then start it
+ * with a thread of its own
+ * (hdlc_link_start) or hand several to one thread (hdlc_links_start). Port
+ * threads talk to a link through its mailbox exactly as to hdlc_init()'s;
+ * on a shared thread requests must be posted with hdlc_link_post() so the
+ * thread wakes up.
+ */
+void hdlc_link_init(hdlc_link_t *link, RawSerial *uart);
+Mail<msg_t, HDLC_MAILBOX_SIZE> *hdlc_link_start(hdlc_link_t *link, Thread *thread);
+void hdlc_links_start(hdlc_link_t **links, unsigned int num, Thread *thread);
+Mail<msg_t, HDLC_MAILBOX_SIZE> *hdlc_link_mailbox(hdlc_link_t *link);
+osStatus hdlc_link_post(hdlc_link_t *link, msg_t *msg);
+int hdlc_link_register(hdlc_link_t *link, hdlc_entry_t *entry);
+void hdlc_link_unregister(hdlc_link_t *link, hdlc_entry_t *entry);
+hdlc_entry_t *hdlc_link_lookup(hdlc_link_t *link, uint16_t port);
+uint32_t hdlc_link_get_rto_usec(hdlc_link_t *link);
+uint32_t hdlc_link_get_srtt_usec(hdlc_link_t *link);
+void hdlc_link_get_stats(hdlc_link_t *link, hdlc_link_stats_t *stats);
+void hdlc_link_set_class_depth(hdlc_link_t *link, unsigned int tx_class,
+                               unsigned int depth);
+void hdlc_link_set_ack_policy(hdlc_link_t *link, unsigned int every,
+                              uint32_t delay_usec);
+int hdlc_send_async(hdlc_link_t *link, hdlc_send_t *send);
 int hdlc_send_command(hdlc_pkt_t *pkt, Mail<msg_t, HDLC_MAILBOX_SIZE> *sender_mailbox, riot_to_mbed_t reply);
 
 #endif /* HDLC_H_ */
\ No newline at end of file
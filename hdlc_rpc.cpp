@@ -0,0 +1,271 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+
+/**
+ * @file        hdlc_rpc.cpp
+ * @brief       Request/response calls over an hdlc link, see hdlc_rpc.h.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include "mbed.h"
+#include "rtos.h"
+#include "hdlc.h"
+#include "hdlc_rpc.h"
+#include "uart_pkt.h"
+#include "utlist.h"
+
+/**
+ * Where the next call looks for a free port. Going round the whole range
+ * rather than reusing the lowest free port keeps a late reply to one call
+ * from landing on the next.
+ */
+static unsigned int _rpc_next_port;
+
+/* give @p call a port of its own in the HDLC_RPC_PORT_BASE range */
+static int _rpc_port(hdlc_rpc_t *rpc, hdlc_rpc_call_t *call)
+{
+    int ret = -EBUSY;
+
+    core_util_critical_section_enter();
+    for (unsigned int i = 0; i < HDLC_RPC_PORTS; i++) {
+        call->entry.port = HDLC_RPC_PORT_BASE + _rpc_next_port;
+        _rpc_next_port = (_rpc_next_port + 1) % HDLC_RPC_PORTS;
+        if (hdlc_link_lookup(rpc->link, call->entry.port) == NULL) {
+            ret = hdlc_link_register(rpc->link, &call->entry) < 0 ? -ENOSPC : 0;
+            break;
+        }
+    }
+    core_util_critical_section_exit();
+    return ret;
+}
+
+/**
+ * On the hdlc thread, once send->status is set: mark the call sent and wake
+ * hdlc_rpc_wait(). Setting sent is the last touch of the call, so the owner
+ * may take it back as soon as it sees it; the wakeup is rpc's own reserved
+ * message, so it cannot get lost to a full mailbox.
+ */
+static void _rpc_sent(hdlc_send_t *send)
+{
+    hdlc_rpc_t *rpc = (hdlc_rpc_t *)send->arg;
+    hdlc_rpc_call_t *call = (hdlc_rpc_call_t *)((char *)send -
+                            offsetof(hdlc_rpc_call_t, send));
+
+    call->sent = true;
+    if (!rpc->sent_pending) {
+        rpc->sent_pending = true;
+        rpc->mailbox.put(rpc->sent_msg);
+    }
+}
+
+/**
+ * @brief Set up @p rpc for the calling thread's calls on @p link, each sent
+ *        in transmit class @p tx_class.
+ */
+void hdlc_rpc_init(hdlc_rpc_t *rpc, hdlc_link_t *link, uint8_t tx_class)
+{
+    rpc->link = link;
+    rpc->calls = NULL;
+    rpc->tx_class = tx_class;
+    rpc->sent_msg = rpc->mailbox.alloc();
+    rpc->sent_msg->type = HDLC_RESP_SND_SUCC;
+    rpc->sent_msg->content.ptr = NULL;
+    rpc->sent_msg->sender_pid = osThreadGetId();
+    rpc->sent_msg->source_mailbox = NULL;
+    rpc->sent_pending = false;
+    rpc->time.start();
+}
+
+/**
+ * @brief Send @p pkt as the request of @p call and return at once. The
+ *        header's src_port is overwritten with the call's own port; the
+ *        rest of the header is the caller's. A packet in pieces (see
+ *        hdlc_pkt_iov()) must have the whole header, writable, in its
+ *        first. @p pkt and @p call must stay valid until hdlc_rpc_wait()
+ *        hands @p call back.
+ * @param  reply_mask HDLC_RPC_REPLY() of each pkt_type that answers it.
+ * @param  timeout_ms Deadline for the reply; 0 waits however long it takes.
+ * @return            0, -EINVAL if @p pkt has no header, -EBUSY or -ENOSPC
+ *                    if there is no port for it, -ENOMEM if the link's
+ *                    mailbox is full.
+ */
+int hdlc_rpc_call(hdlc_rpc_t *rpc, hdlc_rpc_call_t *call, hdlc_pkt_t *pkt,
+                  uint32_t reply_mask, uint32_t timeout_ms)
+{
+    uart_pkt_hdr_t hdr;
+    int ret;
+
+    if (pkt->data == NULL &&
+        (pkt->iovcnt == 0 || pkt->iov[0].len < UART_PKT_HDR_LEN)) {
+        return -EINVAL;
+    }
+    if (hdlc_pkt_parse_hdr(&hdr, pkt) < 0) {
+        return -EINVAL;
+    }
+    call->entry.mailbox = &rpc->mailbox;
+    call->entry.tx_class = rpc->tx_class;
+    ret = _rpc_port(rpc, call);
+    if (ret < 0) {
+        return ret;
+    }
+    hdr.src_port = call->entry.port;
+    if (pkt->data != NULL) {
+        uart_pkt_insert_hdr(pkt->data, pkt->length, &hdr);
+    } else {
+        uart_pkt_insert_hdr((void *)pkt->iov[0].base, pkt->iov[0].len, &hdr);
+    }
+
+    memset(&call->send, 0, sizeof(call->send));
+    call->send.pkt = pkt;
+    call->send.timeout_ms = timeout_ms;
+    call->send.done = _rpc_sent;
+    call->send.arg = rpc;
+    call->reply_mask = reply_mask;
+    call->deadline = rpc->time.read_ms() + (int)timeout_ms;
+    call->sent = false;
+    call->replied = false;
+    call->status = HDLC_RPC_PENDING;
+    call->reply = NULL;
+    if (hdlc_send_async(rpc->link, &call->send) < 0) {
+        hdlc_link_unregister(rpc->link, &call->entry);
+        return -ENOMEM;
+    }
+    LL_APPEND(rpc->calls, call);
+    return 0;
+}
+
+/**
+ * Whether @p call is over, and if so how; if not, lowers @p next to when
+ * its deadline is due. A call only ends once _rpc_sent() has run for it;
+ * send.status alone is set before that, while the hdlc thread still holds
+ * the call.
+ */
+static bool _rpc_over(hdlc_rpc_call_t *call, int now, uint32_t *next)
+{
+    int left;
+
+    if (!call->sent) {
+        return false;
+    }
+    if (call->send.status == HDLC_SEND_REJECTED) {
+        call->status = HDLC_RPC_REJECTED;
+        return true;
+    }
+    if (call->replied) {
+        call->status = HDLC_RPC_DONE;
+        return true;
+    }
+    if (call->send.timeout_ms == 0) {
+        return false;
+    }
+    left = call->deadline - now;
+    if (left <= 0) {
+        call->status = HDLC_RPC_TIMED_OUT;
+        return true;
+    }
+    if ((uint32_t)left < *next) {
+        *next = (uint32_t)left;
+    }
+    return false;
+}
+
+/* a reply for one of the calls, or _rpc_sent()'s wakeup */
+static void _rpc_msg(hdlc_rpc_t *rpc, msg_t *msg)
+{
+    hdlc_rpc_call_t *call = NULL;
+    hdlc_buf_t *buf;
+    uart_pkt_hdr_t hdr;
+
+    if (msg == rpc->sent_msg) {
+        /* reserved, don't free it; the calls are looked at after this */
+        rpc->sent_pending = false;
+        return;
+    }
+    if (msg->type == HDLC_PKT_RDY) {
+        buf = (hdlc_buf_t *)msg->content.ptr;
+        if (uart_pkt_parse_hdr(&hdr, buf->data, buf->length) >= 0) {
+            LL_SEARCH_SCALAR(rpc->calls, call, entry.port, hdr.dst_port);
+        }
+        if (call != NULL && !call->replied && hdr.pkt_type < 32 &&
+            (call->reply_mask & HDLC_RPC_REPLY(hdr.pkt_type))) {
+            call->reply = buf;
+            call->replied = true;
+        } else {
+            /* late, not asked for, or a second answer */
+            hdlc_pkt_release(buf);
+        }
+    }
+    rpc->mailbox.free(msg);
+}
+
+/**
+ * @brief Wait up to @p millisec for one of @p rpc's calls to end.
+ * @return The call, with status and (when DONE) reply set, or NULL if none
+ *         ended in time. It is the caller's again, as is its packet.
+ */
+hdlc_rpc_call_t *hdlc_rpc_wait(hdlc_rpc_t *rpc, uint32_t millisec)
+{
+    hdlc_rpc_call_t *call;
+    int start = rpc->time.read_ms(), now;
+    uint32_t next;
+    osEvent evt;
+
+    while (1) {
+        while ((evt = rpc->mailbox.get(0)).status == osEventMail) {
+            _rpc_msg(rpc, (msg_t *)evt.value.p);
+        }
+        now = rpc->time.read_ms();
+        next = osWaitForever;
+        if (millisec != osWaitForever) {
+            next = (uint32_t)(now - start) < millisec ?
+                   millisec - (uint32_t)(now - start) : 0;
+        }
+        LL_FOREACH(rpc->calls, call) {
+            if (_rpc_over(call, now, &next)) {
+                LL_DELETE(rpc->calls, call);
+                hdlc_link_unregister(rpc->link, &call->entry);
+                return call;
+            }
+        }
+        if (next == 0) {
+            return NULL;
+        }
+        evt = rpc->mailbox.get(next);
+        if (evt.status == osEventMail) {
+            _rpc_msg(rpc, (msg_t *)evt.value.p);
+        }
+    }
+}
@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+
+/**
+ * @file        hdlc_rpc.h
+ * @brief       Request/response calls over an hdlc link.
+ *
+ * A call sends one request and completes with the first reply of a type it
+ * asked for, or at its deadline. Calls are matched to replies by source port:
+ * each call in flight sends from a port of its own in the HDLC_RPC_PORT_BASE
+ * range, and the peer must answer to the request's src_port. The wire format
+ * is unchanged, so one thread can run any number of calls at once, and
+ * packets for its other ports never disturb them.
+ *
+ *     hdlc_rpc_init(&rpc, get_hdlc_link(), HDLC_CLASS_CONTROL);
+ *     for (i = 0; i < n; i++)
+ *         hdlc_rpc_call(&rpc, &call[i], &req[i],
+ *                       HDLC_RPC_REPLY(SOUND_RANGE_DONE), 500);
+ *     while (n && (c = hdlc_rpc_wait(&rpc, osWaitForever)) != NULL) {
+ *         ... c->status, c->reply; hdlc_pkt_release(c->reply) ...
+ *         n--;
+ *     }
+ */
+
+#ifndef HDLC_RPC_H_
+#define HDLC_RPC_H_
+
+#include "mbed.h"
+#include "rtos.h"
+#include "hdlc.h"
+
+/**
+ * Source ports calls are sent from, one per call in flight. Nothing else may
+ * be registered in this range.
+ */
+#ifndef HDLC_RPC_PORT_BASE
+#define HDLC_RPC_PORT_BASE      0xC000
+#endif
+#ifndef HDLC_RPC_PORTS
+#define HDLC_RPC_PORTS          256
+#endif
+
+/* reply_mask bit of a reply pkt_type (riot_to_mbed_t, or anything below 32) */
+#define HDLC_RPC_REPLY(type)    (1UL << (type))
+
+typedef enum {
+    HDLC_RPC_PENDING,
+    HDLC_RPC_DONE,              /**< reply holds the answer */
+    HDLC_RPC_TIMED_OUT,         /**< no answer by the deadline */
+    HDLC_RPC_REJECTED           /**< the transmit class queue was full */
+} hdlc_rpc_status_t;
+
+/* one call, owned by the caller until hdlc_rpc_wait() hands it back */
+typedef struct hdlc_rpc_call {
+    struct hdlc_rpc_call *next;
+    hdlc_entry_t entry;         /* its port, which the reply comes back to */
+    hdlc_send_t send;
+    uint32_t reply_mask;
+    int deadline;               /* hdlc_rpc_t.time.read_ms() */
+    volatile bool sent;         /* _rpc_sent() is done with send */
+    bool replied;
+    hdlc_rpc_status_t status;
+    hdlc_buf_t *reply;          /**< when DONE; hdlc_pkt_release() it */
+    void *arg;                  /**< for the caller */
+} hdlc_rpc_call_t;
+
+/**
+ * The calls of one thread on one link. Replies and send completions come
+ * to its own mailbox and are only looked at in hdlc_rpc_wait(), so all of it
+ * belongs to that thread. One message of the mailbox is kept back for the
+ * send completions, which all share it.
+ */
+typedef struct {
+    hdlc_link_t *link;
+    Mail<msg_t, HDLC_MAILBOX_SIZE> mailbox;
+    hdlc_rpc_call_t *calls;     /* in flight */
+    msg_t *sent_msg;            /* reserved wakeup, posted by _rpc_sent() */
+    volatile bool sent_pending;
+    uint8_t tx_class;           /* of every request, see hdlc_entry_t */
+    Timer time;
+} hdlc_rpc_t;
+
+void hdlc_rpc_init(hdlc_rpc_t *rpc, hdlc_link_t *link, uint8_t tx_class);
+int hdlc_rpc_call(hdlc_rpc_t *rpc, hdlc_rpc_call_t *call, hdlc_pkt_t *pkt,
+                  uint32_t reply_mask, uint32_t timeout_ms);
+hdlc_rpc_call_t *hdlc_rpc_wait(hdlc_rpc_t *rpc, uint32_t millisec);
+
+#endif /* HDLC_RPC_H_ */
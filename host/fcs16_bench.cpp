@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        fcs16_bench.cpp
+ * @brief       FCS throughput of each fcs16_buf() engine.
+ *
+ * Usage: fcs16_bench [kbytes] [block]
+ *
+ * Runs fcs16_buf_nibble(), fcs16_buf_slice1(), fcs16_buf_slice4() and
+ * fcs16_buf_slice8() over @p kbytes (default 4096) KB of random data in
+ * @p block byte pieces (default HDLC_MAX_PKT_SIZE + 2, a whole frame's data
+ * and FCS; a replayed capture is closer to a block of the whole capture),
+ * and reports MB/s per engine, best of BENCH_RUNS runs. fcs16() and every
+ * engine must give the X.25 check value for "123456789" and agree on every
+ * block with a table-free, bit at a time FCS; the program exits non-zero if
+ * one does not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mbed.h"
+#include "hdlc.h"
+#include "fcs16.h"
+
+#define BENCH_RUNS  5
+
+typedef unsigned short (*fcs16_engine_t)(unsigned short fcs,
+                                         const unsigned char *buf,
+                                         unsigned int len);
+
+static const struct {
+    const char *name;
+    fcs16_engine_t fn;
+} engines[] = {
+    { "nibble", fcs16_buf_nibble },
+    { "slice1", fcs16_buf_slice1 },
+    { "slice4", fcs16_buf_slice4 },
+    { "slice8", fcs16_buf_slice8 },
+};
+
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+/* keeps the timed calls from being optimised away */
+static volatile unsigned short sink;
+
+/* the FCS straight from the polynomial, no tables */
+static unsigned short fcs16_bitwise(unsigned short fcs, unsigned char value)
+{
+    fcs ^= value;
+    for (int bit = 0; bit < 8; bit++) {
+        fcs = (fcs & 1) ? (fcs >> 1) ^ 0x8408 : fcs >> 1;
+    }
+    return fcs;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int size, block, len, off;
+    unsigned char *data;
+    unsigned short fcs;
+    double t0, t, best;
+    int ret = 0;
+
+    size = (argc > 1 ? atoi(argv[1]) : 4096) * 1024;
+    block = argc > 2 ? atoi(argv[2]) : HDLC_MAX_PKT_SIZE + 2;
+    if (size == 0 || block == 0) {
+        fprintf(stderr, "usage: %s [kbytes] [block]\n", argv[0]);
+        return 2;
+    }
+
+    data = (unsigned char *)malloc(size);
+    srand(1);
+    for (unsigned int i = 0; i < size; i++) {
+        data[i] = (unsigned char)rand();
+    }
+
+    /* the CRC-16/X-25 check value, with fcs16() as the last engine */
+    const unsigned char check[] = "123456789";
+    len = strlen((const char *)check);
+    fcs = FCS16_INIT_VALUE;
+    for (unsigned int i = 0; i < len; i++) {
+        fcs = fcs16(fcs, check[i]);
+    }
+    if ((fcs ^ 0xFFFF) != 0x906E) {
+        fprintf(stderr, "fcs16: check value %04x\n", fcs ^ 0xFFFF);
+        ret = 1;
+    }
+    for (unsigned int e = 0; e < NUM_ENGINES; e++) {
+        fcs = engines[e].fn(FCS16_INIT_VALUE, check, len);
+        if ((fcs ^ 0xFFFF) != 0x906E) {
+            fprintf(stderr, "%s: check value %04x\n", engines[e].name,
+                    fcs ^ 0xFFFF);
+            ret = 1;
+        }
+    }
+
+    /* check every engine against the bit at a time FCS */
+    for (off = 0; off < size; off += block) {
+        len = size - off < block ? size - off : block;
+        fcs = FCS16_INIT_VALUE;
+        for (unsigned int i = 0; i < len; i++) {
+            fcs = fcs16_bitwise(fcs, data[off + i]);
+        }
+        if (off == 0 && fcs16_buf(FCS16_INIT_VALUE, data, len) != fcs) {
+            fprintf(stderr, "fcs16_buf: block at 0 wrong\n");
+            ret = 1;
+        }
+        for (unsigned int e = 0; e < NUM_ENGINES; e++) {
+            if (engines[e].fn(FCS16_INIT_VALUE, data + off, len) != fcs) {
+                fprintf(stderr, "%s: block at %u wrong\n", engines[e].name, off);
+                ret = 1;
+            }
+        }
+    }
+
+    printf("%u KB in %u byte blocks:", size / 1024, block);
+    for (unsigned int e = 0; e < NUM_ENGINES; e++) {
+        best = 1e9;
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            t0 = now_sec();
+            for (off = 0; off < size; off += block) {
+                len = size - off < block ? size - off : block;
+                sink ^= engines[e].fn(FCS16_INIT_VALUE, data + off, len);
+            }
+            t = now_sec() - t0;
+            best = t < best ? t : best;
+        }
+        printf(" %s %.1f MB/s%s", engines[e].name, size / best / 1e6,
+               e + 1 < NUM_ENGINES ? "," : "");
+    }
+    if (FCS16_NIBBLE) {
+        printf(" (fcs16_buf() is nibble)");
+    } else {
+        printf(" (fcs16_buf() is slice%d)", FCS16_SLICE);
+    }
+    printf("%s\n", ret ? ", MISMATCH" : "");
+    free(data);
+    return ret;
+}
@@ -0,0 +1,261 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        hdlc_fair_bench.cpp
+ * @brief       How fairly the hdlc link shares the uart between threads
+ *              (run under hdlc_pair).
+ *
+ * Usage: hdlc_pair ./hdlc_fair_bench [seconds] [<outstanding>x<bytes>[a] ...]
+ *
+ * Every spec starts one application thread on its own port that keeps
+ * @p outstanding HDLC_MSG_SND requests of @p bytes in flight for the whole
+ * run, on both sides of the link. The default is the two hdlc_test threads
+ * without their pauses, "1x64 1x64". "6x64 6x16" keeps two threads with
+ * different packet sizes backlogged, which is where the byte-wise round robin
+ * shows; "1x64 7x64" puts a thread that waits for every packet next to one
+ * that pipelines, and the first only gets a share while it has something
+ * queued. Keep the sum of @p outstanding within HDLC_WINDOW_SIZE +
+ * HDLC_TX_QUEUE_SIZE, or threads spend the run sleeping on retries. Run with
+ * MBED_HOST_UART_PACE=1 to make the uart the bottleneck.
+ *
+ * A spec ending in "a" keeps its requests in flight with hdlc_send_async()
+ * instead, each handle submitted again from its completion callback, so the
+ * thread itself only sees received packets and rejected sends.
+ *
+ * Each thread's acknowledged bytes per second is printed along with Jain's
+ * fairness index over them, (sum x)^2 / (n * sum x^2): 1 when all threads get
+ * the same share, 1/n when one of them gets everything.
+ */
+
+#include "mbed.h"
+#include "rtos.h"
+#include "hdlc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "uart_pkt.h"
+
+#define BENCH_PORT          4000
+#define BENCH_PKT_TYPE      0x43
+#define BENCH_MAX_THREADS   8
+
+typedef struct {
+    Mail<msg_t, HDLC_MAILBOX_SIZE> mailbox;
+    hdlc_entry_t entry;
+    /* outlives the thread: sends may still be queued when the run ends */
+    hdlc_pkt_t pkt;
+    char send_data[HDLC_MAX_PKT_SIZE];
+    Thread thread;
+    int outstanding;
+    int async;
+    volatile int running;
+    hdlc_send_t send[HDLC_TX_QUEUE_SIZE];
+    uint64_t tx_bytes;
+    uint32_t tx_frames, retries;
+} bench_thr_t;
+
+Serial                  pc(USBTX, USBRX, 115200);
+
+static bench_thr_t      bench_thr[BENCH_MAX_THREADS];
+static hdlc_link_t      bench_link;
+static int              seconds;
+
+static void bench_send(bench_thr_t *thr)
+{
+    msg_t *msg;
+
+    while ((msg = hdlc_link_mailbox(&bench_link)->alloc()) == NULL) {
+        Thread::wait(1);
+    }
+    msg->type = HDLC_MSG_SND;
+    msg->content.ptr = &thr->pkt;
+    msg->sender_pid = osThreadGetId();
+    msg->source_mailbox = &thr->mailbox;
+    hdlc_link_post(&bench_link, msg);
+}
+
+/* an async send is done, on the hdlc thread: count it and go again */
+static void bench_sent(hdlc_send_t *send)
+{
+    bench_thr_t *thr = (bench_thr_t *)send->arg;
+
+    if (send->status != HDLC_SEND_ACKED) {
+        /* the thread submits it again after a while */
+        return;
+    }
+    thr->tx_frames++;
+    thr->tx_bytes += thr->pkt.length;
+    if (thr->running && hdlc_send_async(&bench_link, send) < 0) {
+        send->status = HDLC_SEND_REJECTED;
+    }
+}
+
+/* submit the async sends that were rejected again */
+static void bench_resubmit(bench_thr_t *thr)
+{
+    for (int i = 0; i < thr->outstanding; i++) {
+        if (thr->send[i].status == HDLC_SEND_REJECTED &&
+            hdlc_send_async(&bench_link, &thr->send[i]) == 0) {
+            thr->retries++;
+        }
+    }
+}
+
+static void _bench_thread(bench_thr_t *thr)
+{
+    uart_pkt_hdr_t send_hdr = { thr->entry.port, thr->entry.port, BENCH_PKT_TYPE };
+    Timer run_time, retry_time;
+    osEvent evt;
+    msg_t *msg;
+
+    /* the payload never changes, so every request can share one packet */
+    thr->pkt.data = thr->send_data;
+    uart_pkt_insert_hdr(thr->pkt.data, thr->pkt.length, &send_hdr);
+    for (unsigned int i = UART_PKT_DATA_FIELD; i < thr->pkt.length; i++) {
+        thr->pkt.data[i] = (char)(i * 7);
+    }
+
+    run_time.start();
+    retry_time.start();
+    thr->running = 1;
+    for (int i = 0; i < thr->outstanding; i++) {
+        if (thr->async) {
+            thr->send[i].pkt = &thr->pkt;
+            thr->send[i].done = bench_sent;
+            thr->send[i].arg = thr;
+            if (hdlc_send_async(&bench_link, &thr->send[i]) < 0) {
+                thr->send[i].status = HDLC_SEND_REJECTED;
+            }
+        } else {
+            bench_send(thr);
+        }
+    }
+    while (run_time.read_ms() < seconds * 1000) {
+        evt = thr->mailbox.get(RTRY_TIMEO_USEC / 1000);
+        if (thr->async && retry_time.read_ms() >= RTRY_TIMEO_USEC / 1000) {
+            bench_resubmit(thr);
+            retry_time.reset();
+        }
+        if (evt.status != osEventMail) {
+            continue;
+        }
+        msg = (msg_t *)evt.value.p;
+
+        switch (msg->type) {
+            case HDLC_RESP_SND_SUCC:
+                thr->tx_frames++;
+                thr->tx_bytes += thr->pkt.length;
+                bench_send(thr);
+                break;
+            case HDLC_RESP_RETRY_W_TIMEO:
+                thr->retries++;
+                Thread::wait(msg->content.value / 1000);
+                bench_send(thr);
+                break;
+            case HDLC_PKT_RDY:
+                hdlc_pkt_release((hdlc_buf_t *)msg->content.ptr);
+                break;
+            default:
+                break;
+        }
+        thr->mailbox.free(msg);
+    }
+    thr->running = 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = getenv("MBED_HOST_NAME") ? getenv("MBED_HOST_NAME") : "A";
+    const char *default_specs[] = { "1x64", "1x64" };
+    const char **specs = default_specs;
+    int threads = 2;
+    double sum = 0, sum_sq = 0, rate;
+
+    seconds = argc > 1 ? atoi(argv[1]) : 5;
+    if (argc > 2) {
+        specs = (const char **)argv + 2;
+        threads = argc - 2;
+    }
+    if (seconds < 1 || threads > BENCH_MAX_THREADS) {
+        fprintf(stderr, "usage: %s [seconds] [<outstanding>x<bytes> ...], "
+                "at most %d threads\n", argv[0], BENCH_MAX_THREADS);
+        return 2;
+    }
+
+    hdlc_link_init(&bench_link, new RawSerial(p28, p27, 115200));
+    for (int i = 0; i < threads; i++) {
+        unsigned int outstanding, bytes;
+        char async = 0;
+
+        if (sscanf(specs[i], "%ux%u%c", &outstanding, &bytes, &async) < 2 ||
+            (async != 0 && async != 'a') ||
+            outstanding < 1 || outstanding > HDLC_TX_QUEUE_SIZE ||
+            bytes < UART_PKT_DATA_FIELD || bytes > HDLC_MAX_PKT_SIZE) {
+            fprintf(stderr, "bad spec \"%s\": outstanding within 1..%d, "
+                    "bytes within %d..%d\n", specs[i], HDLC_TX_QUEUE_SIZE,
+                    UART_PKT_DATA_FIELD, HDLC_MAX_PKT_SIZE);
+            return 2;
+        }
+        bench_thr[i].outstanding = outstanding;
+        bench_thr[i].async = async == 'a';
+        bench_thr[i].pkt.length = bytes;
+        bench_thr[i].entry.port = BENCH_PORT + i;
+        bench_thr[i].entry.mailbox = &bench_thr[i].mailbox;
+        hdlc_link_register(&bench_link, &bench_thr[i].entry);
+    }
+    hdlc_link_start(&bench_link, new Thread(osPriorityRealtime));
+    for (int i = 0; i < threads; i++) {
+        bench_thr[i].thread.start(callback(_bench_thread, &bench_thr[i]));
+    }
+
+    for (int i = 0; i < threads; i++) {
+        bench_thr[i].thread.join();
+    }
+    for (int i = 0; i < threads; i++) {
+        rate = (double)bench_thr[i].tx_bytes / seconds;
+        sum += rate;
+        sum_sq += rate * rate;
+        printf("%s: thread %d (%dx%u%s) tx %u frames %.0f B/s, %u retries\n",
+               name, i, bench_thr[i].outstanding, bench_thr[i].pkt.length,
+               bench_thr[i].async ? "a" : "", bench_thr[i].tx_frames, rate,
+               bench_thr[i].retries);
+    }
+    printf("%s: %d s, %d thr, %.0f B/s total, jain %.3f\n", name, seconds,
+           threads, sum, sum_sq > 0 ? sum * sum / (threads * sum_sq) : 0.0);
+    fflush(stdout);
+
+    /* the hdlc thread never returns; skip static destructors */
+    _exit(0);
+}
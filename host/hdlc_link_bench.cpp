@@ -0,0 +1,358 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        hdlc_link_bench.cpp
+ * @brief       Goodput benchmark for the hdlc link (run under hdlc_pair).
+ *
+ * Usage: hdlc_pair [-p 28,9,13] ./hdlc_link_bench [seconds] [duplex|simplex]
+ *                                     [threads] [slow_ms] [links] [own|shared]
+ *                                     [ui] [control]
+ *
+ * Each of @p threads (default 4) application threads pushes full
+ * HDLC_MAX_PKT_SIZE packets through the HDLC_MSG_SND protocol from its own
+ * port as fast as the link accepts them, and counts what arrives on that port
+ * from the peer. In simplex mode only side A sends. Every packet carries a
+ * running counter so lost or reordered deliveries show up as gaps. With
+ * @p slow_ms every thread holds each received packet that long before
+ * releasing it, like a consumer that prints. The cpu figure is the process's
+ * user + system time over the run, so a busy-waiting transmit path shows up
+ * there even when the link itself is the bottleneck.
+ *
+ * With @p links above 1 (at most 3, on the p28, p9 and p13 uarts) thread i
+ * uses link i % links, each link served by its own thread or, with "shared",
+ * all of them by one thread. The link figures are summed over the links.
+ *
+ * The first @p ui threads (default 0) send best effort UI frames
+ * (HDLC_MSG_SND_UI) instead and get a line of their own; the latency figures
+ * only cover the acknowledged threads. The @p control threads after them are
+ * in HDLC_CLASS_CONTROL and send one packet every BENCH_CONTROL_MS, like a
+ * command stream competing with the rest; they get a line of their own too.
+ * A negative count makes the same threads but leaves them in the normal
+ * class, for comparison.
+ */
+
+#include "mbed.h"
+#include "rtos.h"
+#include "hdlc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "uart_pkt.h"
+
+#define BENCH_PORT          4000
+#define BENCH_PKT_TYPE      0x42
+#define BENCH_MAX_THREADS   8
+#define BENCH_MAX_LINKS     3
+#define BENCH_CONTROL_MS    10
+
+typedef struct {
+    uint32_t tx_frames, rx_frames, rx_gaps, retries;
+    uint64_t tx_bytes, rx_bytes;
+    uint64_t lat_sum, lat_max;
+} bench_stats_t;
+
+typedef struct {
+    Mail<msg_t, HDLC_MAILBOX_SIZE> mailbox;
+    hdlc_entry_t entry;
+    hdlc_link_t *link;
+    /* outlive the thread: a send may still be queued when the run ends */
+    hdlc_pkt_t pkt;
+    char send_data[HDLC_MAX_PKT_SIZE];
+    Thread thread;
+    bench_stats_t stats;
+    int ui;                 /* sends UI frames */
+    int paced;              /* sends every BENCH_CONTROL_MS */
+} bench_thr_t;
+
+Serial                  pc(USBTX, USBRX, 115200);
+
+static bench_thr_t      bench_thr[BENCH_MAX_THREADS];
+static hdlc_link_t      bench_link[BENCH_MAX_LINKS];
+static const PinName    bench_pins[BENCH_MAX_LINKS][2] = {
+    { p28, p27 }, { p9, p10 }, { p13, p14 }
+};
+static int              sending;
+static int              seconds;
+static int              slow_ms;
+
+static void bench_send(bench_thr_t *thr, hdlc_pkt_t *pkt)
+{
+    msg_t *msg;
+
+    while ((msg = hdlc_link_mailbox(thr->link)->alloc()) == NULL) {
+        Thread::wait(1);
+    }
+    msg->type = thr->ui ? HDLC_MSG_SND_UI : HDLC_MSG_SND;
+    msg->content.ptr = pkt;
+    msg->sender_pid = osThreadGetId();
+    msg->source_mailbox = &thr->mailbox;
+    hdlc_link_post(thr->link, msg);
+}
+
+static void _bench_thread(bench_thr_t *thr)
+{
+    hdlc_pkt_t &pkt = thr->pkt;
+    hdlc_buf_t *buf;
+    uart_pkt_hdr_t send_hdr = { thr->entry.port, thr->entry.port, BENCH_PKT_TYPE };
+    uint32_t tx_seq = 0, rx_seq = 0, seq;
+    uint64_t sent_at = 0, next_at = 0, now;
+    Timer run_time;
+    osEvent evt;
+    msg_t *msg;
+
+    pkt.data = thr->send_data;
+    pkt.length = HDLC_MAX_PKT_SIZE;
+    uart_pkt_insert_hdr(pkt.data, HDLC_MAX_PKT_SIZE, &send_hdr);
+    for (int i = UART_PKT_DATA_FIELD + 4; i < HDLC_MAX_PKT_SIZE; i++) {
+        pkt.data[i] = (char)(i * 7);
+    }
+
+    run_time.start();
+    if (sending) {
+        memcpy(pkt.data + UART_PKT_DATA_FIELD, &tx_seq, sizeof(tx_seq));
+        sent_at = mbed_host_time_us();
+        bench_send(thr, &pkt);
+    }
+
+    while (run_time.read_ms() < seconds * 1000) {
+        now = mbed_host_time_us();
+        evt = thr->mailbox.get(next_at == 0 ? 100 :
+                               next_at > now ? (next_at - now + 999) / 1000 : 0);
+        if (next_at && mbed_host_time_us() >= next_at) {
+            next_at = 0;
+            sent_at = mbed_host_time_us();
+            bench_send(thr, &pkt);
+        }
+        if (evt.status != osEventMail) {
+            continue;
+        }
+        msg = (msg_t *)evt.value.p;
+
+        switch (msg->type) {
+            case HDLC_RESP_SND_SUCC:
+                now = mbed_host_time_us();
+                if (!thr->ui) {
+                    thr->stats.lat_sum += now - sent_at;
+                    if (now - sent_at > thr->stats.lat_max) {
+                        thr->stats.lat_max = now - sent_at;
+                    }
+                }
+                thr->stats.tx_frames++;
+                thr->stats.tx_bytes += pkt.length;
+                tx_seq++;
+                memcpy(pkt.data + UART_PKT_DATA_FIELD, &tx_seq, sizeof(tx_seq));
+                if (thr->paced) {
+                    next_at = sent_at + BENCH_CONTROL_MS * 1000;
+                    break;
+                }
+                sent_at = mbed_host_time_us();
+                bench_send(thr, &pkt);
+                break;
+            case HDLC_RESP_RETRY_W_TIMEO:
+                thr->stats.retries++;
+                Thread::wait(msg->content.value / 1000);
+                bench_send(thr, &pkt);
+                break;
+            case HDLC_PKT_RDY:
+                buf = (hdlc_buf_t *)msg->content.ptr;
+                memcpy(&seq, buf->data + UART_PKT_DATA_FIELD, sizeof(seq));
+                if (seq != rx_seq) {
+                    thr->stats.rx_gaps++;
+                }
+                rx_seq = seq + 1;
+                thr->stats.rx_frames++;
+                thr->stats.rx_bytes += buf->length;
+                if (slow_ms) {
+                    Thread::wait(slow_ms);
+                }
+                hdlc_pkt_release(buf);
+                break;
+            default:
+                break;
+        }
+        thr->mailbox.free(msg);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = getenv("MBED_HOST_NAME") ? getenv("MBED_HOST_NAME") : "A";
+    int simplex = argc > 2 && strcmp(argv[2], "simplex") == 0;
+    int threads = argc > 3 ? atoi(argv[3]) : 4;
+    int links = argc > 5 ? atoi(argv[5]) : 1;
+    int shared = argc > 6 && strcmp(argv[6], "shared") == 0;
+    int ui = argc > 7 ? atoi(argv[7]) : 0;
+    int control = argc > 8 ? atoi(argv[8]) : 0;
+    int paced = control < 0 ? -control : control;
+    hdlc_link_t *link_ptr[BENCH_MAX_LINKS];
+    bench_stats_t total, ui_total, ctl_total;
+    hdlc_link_stats_t link, one;
+    struct rusage usage;
+    double cpu;
+
+    seconds = argc > 1 ? atoi(argv[1]) : 5;
+    slow_ms = argc > 4 ? atoi(argv[4]) : 0;
+    sending = !simplex || name[0] == 'A';
+    if (threads < 1 || threads > BENCH_MAX_THREADS) {
+        fprintf(stderr, "threads must be within 1..%d\n", BENCH_MAX_THREADS);
+        return 2;
+    }
+    if (links < 1 || links > BENCH_MAX_LINKS) {
+        fprintf(stderr, "links must be within 1..%d\n", BENCH_MAX_LINKS);
+        return 2;
+    }
+    if (ui < 0 || ui > threads) {
+        fprintf(stderr, "ui must be within 0..threads\n");
+        return 2;
+    }
+    if (ui + paced > threads) {
+        fprintf(stderr, "ui + control must be within 0..threads\n");
+        return 2;
+    }
+
+    for (int i = 0; i < links; i++) {
+        hdlc_link_init(&bench_link[i], new RawSerial(bench_pins[i][0],
+                                                  bench_pins[i][1], 115200));
+        link_ptr[i] = &bench_link[i];
+    }
+    for (int i = 0; i < threads; i++) {
+        bench_thr[i].link = &bench_link[i % links];
+        bench_thr[i].entry.port = BENCH_PORT + i;
+        bench_thr[i].entry.mailbox = &bench_thr[i].mailbox;
+        bench_thr[i].ui = i < ui;
+        bench_thr[i].paced = i >= ui && i < ui + paced;
+        if (bench_thr[i].paced && control > 0) {
+            bench_thr[i].entry.tx_class = HDLC_CLASS_CONTROL;
+        }
+        hdlc_link_register(bench_thr[i].link, &bench_thr[i].entry);
+    }
+    if (shared) {
+        hdlc_links_start(link_ptr, links, new Thread(osPriorityRealtime));
+    } else {
+        for (int i = 0; i < links; i++) {
+            hdlc_link_start(&bench_link[i], new Thread(osPriorityRealtime));
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        bench_thr[i].thread.start(callback(_bench_thread, &bench_thr[i]));
+    }
+
+    memset(&total, 0, sizeof(total));
+    memset(&ui_total, 0, sizeof(ui_total));
+    memset(&ctl_total, 0, sizeof(ctl_total));
+    for (int i = 0; i < threads; i++) {
+        bench_thr[i].thread.join();
+        if (bench_thr[i].paced) {
+            ctl_total.tx_frames += bench_thr[i].stats.tx_frames;
+            ctl_total.lat_sum += bench_thr[i].stats.lat_sum;
+            if (bench_thr[i].stats.lat_max > ctl_total.lat_max) {
+                ctl_total.lat_max = bench_thr[i].stats.lat_max;
+            }
+            ctl_total.retries += bench_thr[i].stats.retries;
+            ctl_total.rx_gaps += bench_thr[i].stats.rx_gaps;
+            continue;
+        }
+        if (bench_thr[i].ui) {
+            ui_total.tx_frames += bench_thr[i].stats.tx_frames;
+            ui_total.tx_bytes += bench_thr[i].stats.tx_bytes;
+            ui_total.rx_frames += bench_thr[i].stats.rx_frames;
+            ui_total.rx_bytes += bench_thr[i].stats.rx_bytes;
+            ui_total.rx_gaps += bench_thr[i].stats.rx_gaps;
+            continue;
+        }
+        total.tx_frames += bench_thr[i].stats.tx_frames;
+        total.tx_bytes += bench_thr[i].stats.tx_bytes;
+        total.rx_frames += bench_thr[i].stats.rx_frames;
+        total.rx_bytes += bench_thr[i].stats.rx_bytes;
+        total.rx_gaps += bench_thr[i].stats.rx_gaps;
+        total.retries += bench_thr[i].stats.retries;
+        total.lat_sum += bench_thr[i].stats.lat_sum;
+        if (bench_thr[i].stats.lat_max > total.lat_max) {
+            total.lat_max = bench_thr[i].stats.lat_max;
+        }
+    }
+
+    memset(&link, 0, sizeof(link));
+    for (int i = 0; i < links; i++) {
+        hdlc_link_get_stats(&bench_link[i], &one);
+        link.tx_resent += one.tx_resent;
+        link.tx_acks += one.tx_acks;
+        link.tx_rejects += one.tx_rejects;
+        link.tx_rnrs += one.tx_rnrs;
+        link.tx_aged += one.tx_aged;
+        link.rx_out_of_seq += one.rx_out_of_seq;
+        link.rx_errors += one.rx_errors;
+        link.rx_dropped += one.rx_dropped;
+        link.rx_overruns += one.rx_overruns;
+    }
+    getrusage(RUSAGE_SELF, &usage);
+    cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+          (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+
+    printf("%s: %d s, %d thr, %d link%s, tx %u frames %.0f B/s (avg latency %.0f us, "
+           "max %.0f us, %u retries, rto %u us, srtt %u us), "
+           "rx %u frames %.0f B/s (%u gaps), cpu %.0f%%, link: %u resent, "
+           "%u acks sent, %u rejects sent, %u rnrs sent, %u out of seq, %u errors, "
+           "%u dropped, %u overruns\n",
+           name, seconds, threads, links,
+           links == 1 ? "" : shared ? "s shared" : "s", total.tx_frames,
+           (double)total.tx_bytes / seconds,
+           total.tx_frames ? (double)total.lat_sum / total.tx_frames : 0.0,
+           (double)total.lat_max, total.retries, (unsigned)hdlc_link_get_rto_usec(&bench_link[0]),
+           (unsigned)hdlc_link_get_srtt_usec(&bench_link[0]), total.rx_frames,
+           (double)total.rx_bytes / seconds, total.rx_gaps,
+           100.0 * cpu / seconds, link.tx_resent, link.tx_acks, link.tx_rejects,
+           link.tx_rnrs, link.rx_out_of_seq, link.rx_errors, link.rx_dropped,
+           link.rx_overruns);
+    if (ui) {
+        printf("%s: %d of them ui, tx %u frames %.0f B/s, rx %u frames %.0f B/s "
+               "(%u gaps)\n", name, ui, ui_total.tx_frames,
+               (double)ui_total.tx_bytes / seconds, ui_total.rx_frames,
+               (double)ui_total.rx_bytes / seconds, ui_total.rx_gaps);
+    }
+    if (paced) {
+        printf("%s: %d of them %s paced, tx %u frames (avg latency %.0f us, "
+               "max %.0f us, %u retries), %u rx gaps, %u aged\n", name, paced,
+               control > 0 ? "control" : "normal", ctl_total.tx_frames,
+               ctl_total.tx_frames ? (double)ctl_total.lat_sum / ctl_total.tx_frames : 0.0,
+               (double)ctl_total.lat_max, ctl_total.retries, ctl_total.rx_gaps,
+               link.tx_aged);
+    }
+    fflush(stdout);
+
+    /* the hdlc thread never returns; skip static destructors */
+    _exit(0);
+}
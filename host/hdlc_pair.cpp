@@ -0,0 +1,287 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        hdlc_pair.cpp
+ * @brief       Run two copies of a host hdlc program wired back-to-back.
+ *
+ * Usage: hdlc_pair [-d usec] [-e n | -p pin[,pin...]] <program> [args...]
+ *
+ * A socketpair stands in for the UART cable. Each child gets one end through
+ * MBED_HOST_UART=fd:<n> and its role through MBED_HOST_NAME=A or B. With -d
+ * the two ends are joined through a relay that holds every chunk of bytes
+ * for the given one-way latency, which emulates a slow peer turnaround; -e
+ * has the relay flip a bit in one byte out of every n on average, like a
+ * noisy cable. With -p there is one cable per listed tx pin instead, handed
+ * over as MBED_HOST_UART_P<pin>, for programs that open several links. When
+ * one side exits the other is given a grace period and then terminated.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define GRACE_PERIOD_SEC    3
+#define RELAY_CHUNKS        4096
+#define RELAY_CHUNK_SIZE    256
+#define MAX_CABLES          8
+
+typedef struct {
+    uint64_t due;
+    int len;
+    unsigned char data[RELAY_CHUNK_SIZE];
+} relay_chunk_t;
+
+/* one direction of the emulated cable */
+typedef struct {
+    int in, out;
+    relay_chunk_t *chunks;
+    unsigned int head, count;
+} relay_dir_t;
+
+static uint64_t relay_delay_us;
+static unsigned int relay_error_n;
+static pid_t pid[2];
+
+/* don't leave the children running when we are interrupted or timed out */
+static void forward_signal(int sig)
+{
+    kill(pid[0], SIGTERM);
+    kill(pid[1], SIGTERM);
+    _exit(128 + sig);
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void *relay(void *arg)
+{
+    relay_dir_t *dir = (relay_dir_t *)arg;
+    struct pollfd pfd[2];
+    uint64_t now, next;
+    int timeout;
+
+    for (;;) {
+        now = now_us();
+        next = UINT64_MAX;
+        for (int d = 0; d < 2; d++) {
+            relay_dir_t *r = &dir[d];
+
+            while (r->count > 0 && r->chunks[r->head].due <= now) {
+                relay_chunk_t *c = &r->chunks[r->head];
+                if (write(r->out, c->data, c->len) != c->len) {
+                    return NULL;
+                }
+                r->head = (r->head + 1) % RELAY_CHUNKS;
+                r->count--;
+            }
+            if (r->count > 0 && r->chunks[r->head].due < next) {
+                next = r->chunks[r->head].due;
+            }
+            pfd[d].fd = r->in;
+            pfd[d].events = r->count < RELAY_CHUNKS ? POLLIN : 0;
+        }
+
+        timeout = next == UINT64_MAX ? -1 : (int)((next - now + 999) / 1000);
+        if (poll(pfd, 2, timeout) < 0 && errno != EINTR) {
+            return NULL;
+        }
+
+        for (int d = 0; d < 2; d++) {
+            relay_dir_t *r = &dir[d];
+            relay_chunk_t *c;
+
+            if (!(pfd[d].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            c = &r->chunks[(r->head + r->count) % RELAY_CHUNKS];
+            c->len = (int)read(r->in, c->data, RELAY_CHUNK_SIZE);
+            if (c->len <= 0) {
+                return NULL;
+            }
+            for (int i = 0; relay_error_n && i < c->len; i++) {
+                if (rand() % relay_error_n == 0) {
+                    c->data[i] ^= 1 << (rand() % 8);
+                }
+            }
+            c->due = now_us() + relay_delay_us;
+            r->count++;
+        }
+    }
+}
+
+/* hand @p fds[i] to the child as the uart on tx pin @p pins[i], 0 = any */
+static pid_t spawn(char **argv, const int *fds, const int *pins, int nfds,
+                   const int *close_fds, int nclose, const char *name)
+{
+    char spec[32], var[32];
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        for (int i = 0; i < nclose; i++) {
+            close(close_fds[i]);
+        }
+        for (int i = 0; i < nfds; i++) {
+            snprintf(spec, sizeof(spec), "fd:%d", fds[i]);
+            if (pins[i]) {
+                snprintf(var, sizeof(var), "MBED_HOST_UART_P%d", pins[i]);
+            } else {
+                snprintf(var, sizeof(var), "MBED_HOST_UART");
+            }
+            setenv(var, spec, 1);
+        }
+        setenv("MBED_HOST_NAME", name, 1);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    return pid;
+}
+
+int main(int argc, char **argv)
+{
+    int sv[2], sw[2];
+    int pins[MAX_CABLES] = { 0 }, ncables = 1;
+    pid_t done;
+    int status, ret = 0;
+    int argi = 1;
+
+    while (argi + 1 < argc && argv[argi][0] == '-') {
+        if (strcmp(argv[argi], "-d") == 0) {
+            relay_delay_us = strtoull(argv[argi + 1], NULL, 0);
+        } else if (strcmp(argv[argi], "-e") == 0) {
+            relay_error_n = (unsigned int)strtoul(argv[argi + 1], NULL, 0);
+        } else if (strcmp(argv[argi], "-p") == 0) {
+            char *p = argv[argi + 1];
+
+            for (ncables = 0; *p && ncables < MAX_CABLES; ncables++) {
+                pins[ncables] = (int)strtol(p, &p, 10);
+                if (*p == ',') {
+                    p++;
+                }
+            }
+        } else {
+            break;
+        }
+        argi += 2;
+    }
+    if (argc <= argi || ncables == 0 ||
+        (ncables > 1 && (relay_delay_us || relay_error_n))) {
+        fprintf(stderr, "usage: %s [-d usec] [-e n | -p pin[,pin...]] "
+                "<program> [args...]\n", argv[0]);
+        return 2;
+    }
+
+    if (relay_delay_us == 0 && relay_error_n == 0) {
+        int ends[2][MAX_CABLES];
+
+        for (int i = 0; i < ncables; i++) {
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+                perror("socketpair");
+                return 1;
+            }
+            ends[0][i] = sv[0];
+            ends[1][i] = sv[1];
+        }
+        pid[0] = spawn(argv + argi, ends[0], pins, ncables, ends[1], ncables, "A");
+        pid[1] = spawn(argv + argi, ends[1], pins, ncables, ends[0], ncables, "B");
+        for (int i = 0; i < ncables; i++) {
+            close(ends[0][i]);
+            close(ends[1][i]);
+        }
+    } else {
+        static relay_dir_t dir[2];
+        pthread_t tid;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 ||
+            socketpair(AF_UNIX, SOCK_STREAM, 0, sw) < 0) {
+            perror("socketpair");
+            return 1;
+        }
+        /* A <-> sv[0] | relay sv[1] <-> sw[1] | sw[0] <-> B */
+        int fds_a[3] = { sv[1], sw[0], sw[1] };
+        int fds_b[3] = { sv[0], sv[1], sw[1] };
+        pid[0] = spawn(argv + argi, &sv[0], pins, 1, fds_a, 3, "A");
+        pid[1] = spawn(argv + argi, &sw[0], pins, 1, fds_b, 3, "B");
+        close(sv[0]);
+        close(sw[0]);
+
+        dir[0].in = sv[1];
+        dir[0].out = sw[1];
+        dir[1].in = sw[1];
+        dir[1].out = sv[1];
+        for (int d = 0; d < 2; d++) {
+            dir[d].chunks = (relay_chunk_t *)calloc(RELAY_CHUNKS, sizeof(relay_chunk_t));
+        }
+        pthread_create(&tid, NULL, relay, dir);
+    }
+
+    signal(SIGINT, forward_signal);
+    signal(SIGTERM, forward_signal);
+
+    done = wait(&status);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        ret = 1;
+    }
+
+    for (int i = 0; i < GRACE_PERIOD_SEC * 10; i++) {
+        if (waitpid(done == pid[0] ? pid[1] : pid[0], &status, WNOHANG) > 0) {
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                ret = 1;
+            }
+            return ret;
+        }
+        usleep(100000);
+    }
+    kill(done == pid[0] ? pid[1] : pid[0], SIGTERM);
+    wait(&status);
+    return ret;
+}
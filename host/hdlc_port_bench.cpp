@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        hdlc_port_bench.cpp
+ * @brief       Port dispatch cost, utlist search vs. the hdlc port table.
+ *
+ * Usage: hdlc_port_bench [lookups]
+ *
+ * For 4, 32 and 256 registered ports (random, distinct) times @p lookups
+ * (default 1000000) lookups of registered ports in random order, once with
+ * the LL_SEARCH_SCALAR() the receive path used to do over a list built by
+ * LL_PREPEND() and once with hdlc_link_lookup(). It then unregisters every
+ * other port and checks that the rest are still found. Built against an
+ * hdlc.cpp with HDLC_PORT_TABLE_SIZE 512 so that 256 ports fit; exits
+ * non-zero if a lookup returns the wrong entry.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "mbed.h"
+#include "rtos.h"
+#include "hdlc.h"
+#include "utlist.h"
+
+#define BENCH_MAX_PORTS     256
+
+static hdlc_link_t      bench_link;
+/* hdlc_entry_t as the list had it, threaded through next */
+typedef struct bench_list_entry {
+    struct bench_list_entry *next;
+    uint16_t port;
+    Mail<msg_t, HDLC_MAILBOX_SIZE> *mailbox;
+} bench_list_entry_t;
+
+static hdlc_entry_t     entries[BENCH_MAX_PORTS];
+static bench_list_entry_t list_entries[BENCH_MAX_PORTS];
+static const unsigned int port_counts[] = { 4, 32, 256 };
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(unsigned int nports, unsigned int lookups, unsigned int *order)
+{
+    bench_list_entry_t *list = NULL, *list_entry;
+    hdlc_entry_t *entry;
+    unsigned long sum_list = 0, sum_table = 0, expect = 0;
+    double t0, t_list, t_table;
+    int ret = 0;
+
+    for (unsigned int i = 0; i < nports; i++) {
+        bool dup;
+        do {
+            entries[i].port = (uint16_t)rand();
+            dup = false;
+            for (unsigned int k = 0; k < i; k++) {
+                dup = dup || entries[k].port == entries[i].port;
+            }
+        } while (dup);
+        list_entries[i].port = entries[i].port;
+        LL_PREPEND(list, &list_entries[i]);
+    }
+    for (unsigned int i = 0; i < lookups; i++) {
+        order[i] = rand() % nports;
+        expect += entries[order[i]].port;
+    }
+
+    t0 = now_sec();
+    for (unsigned int i = 0; i < lookups; i++) {
+        LL_SEARCH_SCALAR(list, list_entry, port, entries[order[i]].port);
+        sum_list += list_entry->port;
+    }
+    t_list = now_sec() - t0;
+
+    for (unsigned int i = 0; i < nports; i++) {
+        if (hdlc_link_register(&bench_link, &entries[i]) < 0) {
+            fprintf(stderr, "port table full at %u ports\n", i);
+            return -1;
+        }
+    }
+    t0 = now_sec();
+    for (unsigned int i = 0; i < lookups; i++) {
+        entry = hdlc_link_lookup(&bench_link, entries[order[i]].port);
+        sum_table += entry->port;
+    }
+    t_table = now_sec() - t0;
+
+    if (sum_list != expect || sum_table != expect) {
+        fprintf(stderr, "%u ports: lookups returned the wrong entries\n", nports);
+        ret = -1;
+    }
+    for (unsigned int i = 0; i < nports; i += 2) {
+        hdlc_link_unregister(&bench_link, &entries[i]);
+    }
+    for (unsigned int i = 0; i < nports; i++) {
+        entry = hdlc_link_lookup(&bench_link, entries[i].port);
+        if (entry != (i % 2 ? &entries[i] : NULL)) {
+            fprintf(stderr, "%u ports: port %u wrong after unregister\n",
+                    nports, entries[i].port);
+            ret = -1;
+        }
+    }
+    for (unsigned int i = 1; i < nports; i += 2) {
+        hdlc_link_unregister(&bench_link, &entries[i]);
+    }
+
+    printf("%3u ports: list %.1f ns/lookup, table %.1f ns/lookup (%.1fx)%s\n",
+           nports, t_list / lookups * 1e9, t_table / lookups * 1e9,
+           t_list / t_table, ret ? ", MISMATCH" : "");
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int lookups = argc > 1 ? atoi(argv[1]) : 1000000;
+    unsigned int *order;
+    RawSerial uart(p9, p10, 115200);
+    int ret = 0;
+
+    if (lookups == 0) {
+        fprintf(stderr, "usage: %s [lookups]\n", argv[0]);
+        return 2;
+    }
+    order = (unsigned int *)malloc(lookups * sizeof(*order));
+    hdlc_link_init(&bench_link, &uart);
+    srand(1);
+    for (unsigned int i = 0; i < sizeof(port_counts) / sizeof(port_counts[0]); i++) {
+        if (run(port_counts[i], lookups, order) < 0) {
+            ret = 1;
+        }
+    }
+    fflush(stdout);
+
+    /* skip the static destructors of the never started hdlc thread */
+    _exit(ret);
+}
@@ -0,0 +1,296 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+
+/**
+ * @file        hdlc_rpc_bench.cpp
+ * @brief       Pipelined request/response calls with hdlc_rpc (run under
+ *              hdlc_pair).
+ *
+ * Usage: hdlc_pair [-e n] ./hdlc_rpc_bench [seconds] [burst] [service_ms]
+ *
+ * Side A is a ranging controller: it issues @p burst (default 8)
+ * SOUND_RANGE_X10_REQ calls at a time with hdlc_rpc_call(), each request a
+ * header and a cookie framed in place (hdlc_pkt_iov()), and waits for all
+ * of them before the next burst. Side B plays the peer: it answers each
+ * request with SOUND_RANGE_DONE after a random 0..2 * @p service_ms (default
+ * 20), so replies come back out of order, and before every fourth answer it
+ * sends the call's port an RSSI_DATA_PKT that nobody asked for, and A's own
+ * port a packet too. Every reply echoes its request's cookie, so a reply
+ * matched to the wrong call shows up; the program exits non-zero if one
+ * does. Burst 1 is the one-call-at-a-time hdlc_send_command() pattern.
+ */
+
+#include "mbed.h"
+#include "rtos.h"
+#include "hdlc.h"
+#include "hdlc_rpc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "uart_pkt.h"
+
+#define BENCH_RANGE_PORT    170     /* B's ranging service */
+#define BENCH_APP_PORT      4000    /* A's own port, sent noise by B */
+#define BENCH_MAX_BURST     32
+#define BENCH_TIMEOUT_MS    1000
+
+/* an answer B owes, sent at due */
+typedef struct {
+    int used;
+    int due;
+    uint16_t port;
+    uint32_t cookie;
+    hdlc_send_t send;
+    hdlc_pkt_t pkt;
+    char data[UART_PKT_DATA_FIELD + 4];
+} bench_answer_t;
+
+Serial                  pc(USBTX, USBRX, 115200);
+
+static hdlc_link_t      bench_link;
+static Mail<msg_t, HDLC_MAILBOX_SIZE> bench_mailbox;
+static hdlc_entry_t     bench_entry;
+static hdlc_rpc_t       rpc;
+static hdlc_rpc_call_t  calls[BENCH_MAX_BURST];
+static hdlc_pkt_t       reqs[BENCH_MAX_BURST];
+static uart_pkt_hdr_t   req_hdr[BENCH_MAX_BURST];
+static uint32_t         req_cookie[BENCH_MAX_BURST];
+static yahdlc_iovec_t   req_iov[BENCH_MAX_BURST][2];
+/* more than B can owe at once, so an answer slot is always free */
+static bench_answer_t   answers[2 * BENCH_MAX_BURST + 8];
+static int              seconds, burst, service_ms;
+
+/* send @p type with @p cookie from @p src to @p dst through @p a */
+static void bench_answer(bench_answer_t *a, uint16_t src, uint16_t dst,
+                         uint8_t type, uint32_t cookie)
+{
+    uart_pkt_hdr_t hdr = { src, dst, type };
+
+    a->used = 1;
+    a->pkt.data = a->data;
+    a->pkt.length = sizeof(a->data);
+    uart_pkt_insert_hdr(a->data, sizeof(a->data), &hdr);
+    memcpy(a->data + UART_PKT_DATA_FIELD, &cookie, sizeof(cookie));
+    a->send.pkt = &a->pkt;
+    while (hdlc_send_async(&bench_link, &a->send) < 0) {
+        Thread::wait(1);
+    }
+}
+
+/* a slot whose send is over, for another packet */
+static bench_answer_t *bench_free_answer(void)
+{
+    for (unsigned int i = 0; i < sizeof(answers) / sizeof(answers[0]); i++) {
+        if (!answers[i].used && answers[i].send.status != HDLC_SEND_PENDING) {
+            return &answers[i];
+        }
+    }
+    return NULL;
+}
+
+static int bench_peer(void)
+{
+    hdlc_buf_t *buf;
+    uart_pkt_hdr_t hdr;
+    bench_answer_t *a, *stray;
+    uint32_t cookie, served = 0, strays = 0, next;
+    Timer run_time;
+    osEvent evt;
+    msg_t *msg;
+    int now;
+
+    for (unsigned int i = 0; i < sizeof(answers) / sizeof(answers[0]); i++) {
+        answers[i].send.status = HDLC_SEND_ACKED;
+    }
+    run_time.start();
+    /* a little longer than A, so its last burst gets answered */
+    while (run_time.read_ms() < seconds * 1000 + 4 * service_ms + 500) {
+        now = run_time.read_ms();
+        next = 10;
+        for (unsigned int i = 0; i < sizeof(answers) / sizeof(answers[0]); i++) {
+            a = &answers[i];
+            if (!a->used || a->send.status == HDLC_SEND_PENDING) {
+                continue;
+            }
+            if (a->due > now) {
+                if ((uint32_t)(a->due - now) < next) {
+                    next = a->due - now;
+                }
+                continue;
+            }
+            if (served % 4 == 0 && (stray = bench_free_answer()) != NULL) {
+                bench_answer(stray, BENCH_RANGE_PORT, a->port, RSSI_DATA_PKT, ~0u);
+                stray->used = 0;
+                if ((stray = bench_free_answer()) != NULL) {
+                    bench_answer(stray, BENCH_RANGE_PORT, BENCH_APP_PORT,
+                                 SOUND_RANGE_DONE, a->cookie);
+                    stray->used = 0;
+                }
+                strays++;
+            }
+            bench_answer(a, BENCH_RANGE_PORT, a->port, SOUND_RANGE_DONE, a->cookie);
+            a->used = 0;
+            served++;
+        }
+
+        evt = bench_mailbox.get(next);
+        if (evt.status != osEventMail) {
+            continue;
+        }
+        msg = (msg_t *)evt.value.p;
+        if (msg->type == HDLC_PKT_RDY) {
+            buf = (hdlc_buf_t *)msg->content.ptr;
+            if (uart_pkt_parse_hdr(&hdr, buf->data, buf->length) >= 0 &&
+                hdr.pkt_type == SOUND_RANGE_X10_REQ &&
+                (a = bench_free_answer()) != NULL) {
+                memcpy(&cookie, buf->data + UART_PKT_DATA_FIELD, sizeof(cookie));
+                a->used = 1;
+                a->port = hdr.src_port;
+                a->cookie = cookie;
+                a->due = run_time.read_ms() +
+                         (service_ms ? rand() % (2 * service_ms + 1) : 0);
+            }
+            hdlc_pkt_release(buf);
+        }
+        bench_mailbox.free(msg);
+    }
+    printf("B: served %u calls, %u times with strays\n", served, strays);
+    return 0;
+}
+
+static int bench_controller(void)
+{
+    hdlc_rpc_call_t *call;
+    uart_pkt_hdr_t hdr = { 0, BENCH_RANGE_PORT, SOUND_RANGE_X10_REQ };
+    uint32_t cookie = 0, got, done = 0, timed_out = 0, rejected = 0, wrong = 0;
+    uint64_t sent_at[BENCH_MAX_BURST], lat, lat_sum = 0, lat_max = 0;
+    Timer run_time;
+    osEvent evt;
+    int i, n, ret;
+
+    hdlc_rpc_init(&rpc, &bench_link, HDLC_CLASS_CONTROL);
+    run_time.start();
+    while (run_time.read_ms() < seconds * 1000) {
+        for (n = 0; n < burst; n++) {
+            req_hdr[n] = hdr;
+            req_cookie[n] = cookie;
+            req_iov[n][0].base = &req_hdr[n];
+            req_iov[n][0].len = UART_PKT_HDR_LEN;
+            req_iov[n][1].base = &req_cookie[n];
+            req_iov[n][1].len = sizeof(req_cookie[n]);
+            hdlc_pkt_iov(&reqs[n], req_iov[n], 2);
+            calls[n].arg = (void *)(uintptr_t)cookie++;
+            sent_at[n] = mbed_host_time_us();
+            while ((ret = hdlc_rpc_call(&rpc, &calls[n], &reqs[n],
+                                        HDLC_RPC_REPLY(SOUND_RANGE_DONE),
+                                        BENCH_TIMEOUT_MS)) == -ENOMEM) {
+                Thread::wait(1);
+            }
+            if (ret < 0) {
+                fprintf(stderr, "A: hdlc_rpc_call: %d\n", ret);
+                return 1;
+            }
+        }
+        for (i = 0; i < burst; i++) {
+            call = hdlc_rpc_wait(&rpc, osWaitForever);
+            n = call - calls;
+            lat = mbed_host_time_us() - sent_at[n];
+            switch (call->status) {
+                case HDLC_RPC_DONE:
+                    memcpy(&got, call->reply->data + UART_PKT_DATA_FIELD, sizeof(got));
+                    if (got != (uint32_t)(uintptr_t)call->arg) {
+                        wrong++;
+                    }
+                    hdlc_pkt_release(call->reply);
+                    done++;
+                    lat_sum += lat;
+                    if (lat > lat_max) {
+                        lat_max = lat;
+                    }
+                    break;
+                case HDLC_RPC_TIMED_OUT:
+                    timed_out++;
+                    break;
+                default:
+                    rejected++;
+                    break;
+            }
+        }
+        /* the noise B sends A's own port must not have reached the calls */
+        while ((evt = bench_mailbox.get(0)).status == osEventMail) {
+            msg_t *msg = (msg_t *)evt.value.p;
+
+            if (msg->type == HDLC_PKT_RDY) {
+                hdlc_pkt_release((hdlc_buf_t *)msg->content.ptr);
+            }
+            bench_mailbox.free(msg);
+        }
+    }
+
+    printf("A: %d s, burst %d, service %d ms: %u calls %.1f/s (avg latency %.0f us, "
+           "max %.0f us), %u timed out, %u rejected, %u mismatched\n",
+           seconds, burst, service_ms, done, (double)done / seconds,
+           done ? (double)lat_sum / done : 0.0, (double)lat_max, timed_out,
+           rejected, wrong);
+    return wrong ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = getenv("MBED_HOST_NAME") ? getenv("MBED_HOST_NAME") : "A";
+    int ret;
+
+    seconds = argc > 1 ? atoi(argv[1]) : 5;
+    burst = argc > 2 ? atoi(argv[2]) : 8;
+    service_ms = argc > 3 ? atoi(argv[3]) : 20;
+    if (seconds < 1 || burst < 1 || burst > BENCH_MAX_BURST || service_ms < 0) {
+        fprintf(stderr, "usage: %s [seconds] [burst 1..%d] [service_ms]\n",
+                argv[0], BENCH_MAX_BURST);
+        return 2;
+    }
+
+    hdlc_link_init(&bench_link, new RawSerial(p28, p27, 115200));
+    bench_entry.port = name[0] == 'A' ? BENCH_APP_PORT : BENCH_RANGE_PORT;
+    bench_entry.mailbox = &bench_mailbox;
+    hdlc_link_register(&bench_link, &bench_entry);
+    hdlc_link_start(&bench_link, new Thread(osPriorityRealtime));
+    srand(1);
+
+    ret = name[0] == 'A' ? bench_controller() : bench_peer();
+    fflush(stdout);
+
+    /* the hdlc thread never returns; skip static destructors */
+    _exit(ret);
+}
@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+
+/**
+ * @file        hdlc_rpc_test.cpp
+ * @brief       hdlc_rpc calls that time out with their sends (run under
+ *              hdlc_pair).
+ *
+ * Usage: hdlc_pair ./hdlc_rpc_test [seconds] [burst] [timeout_ms]
+ *
+ * Side B never starts its link, so nothing A sends is ever acknowledged or
+ * answered. Side A keeps @p burst (default 16) calls in flight, each with
+ * @p timeout_ms (default 5), which hdlc_rpc_call() also gives the send: the
+ * send times out, or is rejected by a full class queue, just as the call's
+ * deadline comes. Every call and its packet are on the heap, and A
+ * scribbles over and frees each one as soon as hdlc_rpc_wait() hands it
+ * back, so an hdlc thread still at it crashes the program (or shows under
+ * -fsanitize=address). A call that ends any other way, or is not back
+ * within a second of its deadline, fails the test.
+ */
+
+#include "mbed.h"
+#include "rtos.h"
+#include "hdlc.h"
+#include "hdlc_rpc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "uart_pkt.h"
+
+#define TEST_PORT           170     /* nobody there */
+#define TEST_MAX_BURST      32
+
+/* a call and everything it sends from */
+typedef struct {
+    hdlc_rpc_call_t call;
+    hdlc_pkt_t pkt;
+    uart_pkt_hdr_t hdr;
+    uint32_t cookie;
+    yahdlc_iovec_t iov[2];
+} test_call_t;
+
+Serial                  pc(USBTX, USBRX, 115200);
+
+static hdlc_link_t      test_link;
+static hdlc_rpc_t       rpc;
+static int              seconds, burst, timeout_ms;
+
+static int test_call(uint32_t cookie)
+{
+    test_call_t *t = new test_call_t;
+    uart_pkt_hdr_t hdr = { 0, TEST_PORT, SOUND_RANGE_X10_REQ };
+    int ret;
+
+    memset(t, 0, sizeof(*t));
+    t->hdr = hdr;
+    t->cookie = cookie;
+    t->iov[0].base = &t->hdr;
+    t->iov[0].len = UART_PKT_HDR_LEN;
+    t->iov[1].base = &t->cookie;
+    t->iov[1].len = sizeof(t->cookie);
+    hdlc_pkt_iov(&t->pkt, t->iov, 2);
+    t->call.arg = t;
+    while ((ret = hdlc_rpc_call(&rpc, &t->call, &t->pkt,
+                                HDLC_RPC_REPLY(SOUND_RANGE_DONE),
+                                timeout_ms)) == -ENOMEM) {
+        Thread::wait(1);
+    }
+    if (ret < 0) {
+        fprintf(stderr, "A: hdlc_rpc_call: %d\n", ret);
+        delete t;
+    }
+    return ret;
+}
+
+static int test_caller(void)
+{
+    hdlc_rpc_call_t *call;
+    test_call_t *t;
+    uint32_t cookie = 0, timed_out = 0, rejected = 0, bad = 0;
+    Timer run_time;
+    int n;
+
+    hdlc_rpc_init(&rpc, &test_link, HDLC_CLASS_NORMAL);
+    run_time.start();
+    for (n = 0; n < burst; n++) {
+        if (test_call(cookie++) < 0) {
+            return 1;
+        }
+    }
+    while (n > 0) {
+        call = hdlc_rpc_wait(&rpc, timeout_ms + 1000);
+        if (call == NULL) {
+            fprintf(stderr, "A: %d calls not back a second after their "
+                    "deadline\n", n);
+            return 1;
+        }
+        n--;
+        if (call->status == HDLC_RPC_TIMED_OUT) {
+            timed_out++;
+        } else if (call->status == HDLC_RPC_REJECTED) {
+            rejected++;
+        } else {
+            bad++;
+        }
+        /* it is ours again: anyone still using it reads garbage */
+        t = (test_call_t *)call->arg;
+        memset(t, 0xA5, sizeof(*t));
+        delete t;
+        if (run_time.read_ms() < seconds * 1000) {
+            if (test_call(cookie++) < 0) {
+                return 1;
+            }
+            n++;
+        }
+    }
+
+    printf("A: %d s, burst %d, timeout %d ms: %u calls, %u timed out, "
+           "%u rejected, %u otherwise\n", seconds, burst, timeout_ms, cookie,
+           timed_out, rejected, bad);
+    return bad ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = getenv("MBED_HOST_NAME") ? getenv("MBED_HOST_NAME") : "A";
+    int ret;
+
+    seconds = argc > 1 ? atoi(argv[1]) : 3;
+    burst = argc > 2 ? atoi(argv[2]) : 16;
+    timeout_ms = argc > 3 ? atoi(argv[3]) : 5;
+    if (seconds < 1 || burst < 1 || burst > TEST_MAX_BURST || timeout_ms < 1) {
+        fprintf(stderr, "usage: %s [seconds] [burst 1..%d] [timeout_ms]\n",
+                argv[0], TEST_MAX_BURST);
+        return 2;
+    }
+
+    if (name[0] != 'A') {
+        /* the silent peer: holds its end of the line open, reads nothing */
+        sleep(seconds + 2);
+        return 0;
+    }
+    hdlc_link_init(&test_link, new RawSerial(p28, p27, 115200));
+    hdlc_link_start(&test_link, new Thread(osPriorityRealtime));
+
+    ret = test_caller();
+    fflush(stdout);
+
+    /* the hdlc thread never returns; skip static destructors */
+    _exit(ret);
+}
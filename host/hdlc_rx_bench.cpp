@@ -0,0 +1,232 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        hdlc_rx_bench.cpp
+ * @brief       Receive path cost per frame, copied vs. loaned rx buffers
+ *              (run under hdlc_pair).
+ *
+ * Usage: hdlc_pair ./hdlc_rx_bench [seconds] [runs]
+ *        hdlc_pair ./hdlc_rx_bench_copy [seconds] [runs]
+ *
+ * Side A pushes full HDLC_MAX_PKT_SIZE packets from BENCH_THREADS ports as
+ * fast as the link takes them. Side B receives them through the real
+ * _hdlc_receive() and _hdlc_deliver(); its port threads check each packet in
+ * place and release it. B then times @p runs (default 5) windows of
+ * @p seconds (default 2) and reports the process CPU time (user + system,
+ * all threads and the uart shim included) per received frame, best of the
+ * runs. hdlc_rx_bench is built with loaned rx buffers, hdlc_rx_bench_copy
+ * with HDLC_RX_LOAN=0, which decodes into recv_buf and copies each frame on
+ * delivery. Every packet carries a running counter and a fixed pattern; B
+ * exits non-zero on a gap or a corrupt packet.
+ */
+
+#include "mbed.h"
+#include "rtos.h"
+#include "hdlc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "uart_pkt.h"
+
+#define BENCH_PORT          4100
+#define BENCH_PKT_TYPE      0x43
+#define BENCH_THREADS       4
+
+typedef struct {
+    Mail<msg_t, HDLC_MAILBOX_SIZE> mailbox;
+    hdlc_entry_t entry;
+    /* outlives the thread: a send may still be queued when the run ends */
+    hdlc_pkt_t pkt;
+    char send_data[HDLC_MAX_PKT_SIZE];
+    Thread thread;
+} bench_thr_t;
+
+Serial                  pc(USBTX, USBRX, 115200);
+
+static bench_thr_t      bench_thr[BENCH_THREADS];
+static hdlc_link_t      bench_link;
+static int              sending;
+static int              seconds;
+static volatile int     done;
+static uint32_t         rx_frames, rx_bad;  /* under a critical section */
+
+static double cpu_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_send(bench_thr_t *thr)
+{
+    msg_t *msg;
+
+    while ((msg = hdlc_link_mailbox(&bench_link)->alloc()) == NULL) {
+        Thread::wait(1);
+    }
+    msg->type = HDLC_MSG_SND;
+    msg->content.ptr = &thr->pkt;
+    msg->sender_pid = osThreadGetId();
+    msg->source_mailbox = &thr->mailbox;
+    hdlc_link_post(&bench_link, msg);
+}
+
+static void _bench_thread(bench_thr_t *thr)
+{
+    hdlc_pkt_t &pkt = thr->pkt;
+    hdlc_buf_t *buf;
+    uart_pkt_hdr_t send_hdr = { thr->entry.port, thr->entry.port, BENCH_PKT_TYPE };
+    uint32_t tx_seq = 0, rx_seq = 0, seq;
+    int bad;
+    osEvent evt;
+    msg_t *msg;
+
+    pkt.data = thr->send_data;
+    pkt.length = HDLC_MAX_PKT_SIZE;
+    uart_pkt_insert_hdr(pkt.data, HDLC_MAX_PKT_SIZE, &send_hdr);
+    for (int i = UART_PKT_DATA_FIELD + 4; i < HDLC_MAX_PKT_SIZE; i++) {
+        pkt.data[i] = (char)(i * 7);
+    }
+    if (sending) {
+        memcpy(pkt.data + UART_PKT_DATA_FIELD, &tx_seq, sizeof(tx_seq));
+        bench_send(thr);
+    }
+
+    while (!done) {
+        evt = thr->mailbox.get(100);
+        if (evt.status != osEventMail) {
+            continue;
+        }
+        msg = (msg_t *)evt.value.p;
+
+        switch (msg->type) {
+            case HDLC_RESP_SND_SUCC:
+                tx_seq++;
+                memcpy(pkt.data + UART_PKT_DATA_FIELD, &tx_seq, sizeof(tx_seq));
+                bench_send(thr);
+                break;
+            case HDLC_RESP_RETRY_W_TIMEO:
+                Thread::wait(msg->content.value / 1000);
+                bench_send(thr);
+                break;
+            case HDLC_PKT_RDY:
+                /* read in place, as a port thread would */
+                buf = (hdlc_buf_t *)msg->content.ptr;
+                memcpy(&seq, buf->data + UART_PKT_DATA_FIELD, sizeof(seq));
+                bad = seq != rx_seq || buf->length != HDLC_MAX_PKT_SIZE;
+                for (int i = UART_PKT_DATA_FIELD + 4; i < HDLC_MAX_PKT_SIZE; i++) {
+                    bad |= buf->data[i] != (char)(i * 7);
+                }
+                rx_seq = seq + 1;
+                hdlc_pkt_release(buf);
+                core_util_critical_section_enter();
+                rx_frames++;
+                rx_bad += bad;
+                core_util_critical_section_exit();
+                break;
+            default:
+                break;
+        }
+        thr->mailbox.free(msg);
+    }
+}
+
+static uint32_t bench_frames(void)
+{
+    uint32_t n;
+
+    core_util_critical_section_enter();
+    n = rx_frames;
+    core_util_critical_section_exit();
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    const char *name = getenv("MBED_HOST_NAME") ? getenv("MBED_HOST_NAME") : "A";
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+    double cpu0, cpu, best = 0;
+    uint32_t frames0, frames, total = 0;
+
+    seconds = argc > 1 ? atoi(argv[1]) : 2;
+    if (seconds < 1 || runs < 1) {
+        fprintf(stderr, "usage: %s [seconds] [runs]\n", argv[0]);
+        return 2;
+    }
+    sending = name[0] == 'A';
+
+    hdlc_link_init(&bench_link, new RawSerial(p28, p27, 115200));
+    for (int i = 0; i < BENCH_THREADS; i++) {
+        bench_thr[i].entry.port = BENCH_PORT + i;
+        bench_thr[i].entry.mailbox = &bench_thr[i].mailbox;
+        hdlc_link_register(&bench_link, &bench_thr[i].entry);
+    }
+    hdlc_link_start(&bench_link, new Thread(osPriorityRealtime));
+    for (int i = 0; i < BENCH_THREADS; i++) {
+        bench_thr[i].thread.start(callback(_bench_thread, &bench_thr[i]));
+    }
+
+    if (sending) {
+        /* keep B fed until it is done measuring; hdlc_pair ends us then */
+        Thread::wait((seconds * runs + 5) * 1000);
+        _exit(0);
+    }
+
+    while (bench_frames() == 0) {
+        Thread::wait(10);
+    }
+    for (int run = 0; run < runs; run++) {
+        frames0 = bench_frames();
+        cpu0 = cpu_sec();
+        Thread::wait(seconds * 1000);
+        frames = bench_frames() - frames0;
+        cpu = cpu_sec() - cpu0;
+        total += frames;
+        if (frames && (best == 0 || cpu / frames < best)) {
+            best = cpu / frames;
+        }
+    }
+    done = 1;
+
+    printf("%s: %s rx buffers, %u frames in %d x %d s, best %.2f us cpu/frame, "
+           "%u bad%s\n", name, HDLC_RX_LOAN ? "loaned" : "copied", total, runs,
+           seconds, best * 1e6, rx_bad, rx_bad || total == 0 ? ", MISMATCH" : "");
+    fflush(stdout);
+
+    /* the hdlc thread never returns; skip static destructors */
+    _exit(rx_bad || total == 0 ? 1 : 0);
+}
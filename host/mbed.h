@@ -0,0 +1,252 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        mbed.h
+ * @brief       Host (POSIX) stand-in for the subset of mbed-os used by hdlc.
+ *
+ * Only the pieces of the mbed platform API that hdlc.cpp and the apps under
+ * app_files/ touch are provided. A Serial bound to anything other than
+ * USBTX/USBRX is backed by a file descriptor (socketpair end or pty) and its
+ * interrupts are emulated by a per-port thread that runs the attached
+ * callbacks inside the emulated critical section.
+ */
+
+#ifndef MBED_HOST_MBED_H_
+#define MBED_HOST_MBED_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum {
+    p5 = 5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18,
+    p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30,
+
+    LED1 = 100, LED2, LED3, LED4,
+
+    USBTX = 200, USBRX,
+
+    NC = (int)0xFFFFFFFF
+} PinName;
+
+/* emulated interrupt masking; the serial irq threads run inside it */
+void core_util_critical_section_enter(void);
+void core_util_critical_section_exit(void);
+
+void wait(float s);
+void wait_ms(int ms);
+void wait_us(int us);
+
+/* monotonic microsecond clock shared by Timer and the serial emulation */
+uint64_t mbed_host_time_us(void);
+
+template <typename F>
+class Callback;
+
+/**
+ * @brief Minimal Callback<void()>: a plain function or a function taking a
+ *        bound argument pointer.
+ */
+template <>
+class Callback<void()> {
+public:
+    Callback(void (*func)() = 0) : _func(func), _bound(0), _arg(0) {}
+
+    template <typename T>
+    Callback(void (*func)(T *), T *arg)
+        : _func(0), _bound(reinterpret_cast<void (*)(void *)>(func)),
+          _arg((void *)arg) {}
+
+    void call() const
+    {
+        if (_bound) {
+            _bound(_arg);
+        } else if (_func) {
+            _func();
+        }
+    }
+
+    void operator()() const { call(); }
+
+    operator bool() const { return _func || _bound; }
+
+private:
+    void (*_func)();
+    void (*_bound)(void *);
+    void *_arg;
+};
+
+template <typename T>
+Callback<void()> callback(void (*func)(T *), T *arg)
+{
+    return Callback<void()>(func, arg);
+}
+
+inline Callback<void()> callback(void (*func)())
+{
+    return Callback<void()>(func);
+}
+
+class Timer {
+public:
+    Timer() : _running(0), _start(0), _acc(0) {}
+
+    void start()
+    {
+        if (!_running) {
+            _start = mbed_host_time_us();
+            _running = 1;
+        }
+    }
+
+    void stop()
+    {
+        if (_running) {
+            _acc += mbed_host_time_us() - _start;
+            _running = 0;
+        }
+    }
+
+    void reset()
+    {
+        _start = mbed_host_time_us();
+        _acc = 0;
+    }
+
+    int read_us() { return (int)elapsed(); }
+    int read_ms() { return (int)(elapsed() / 1000); }
+    float read() { return (float)elapsed() / 1000000.0f; }
+
+private:
+    uint64_t elapsed()
+    {
+        return _acc + (_running ? mbed_host_time_us() - _start : 0);
+    }
+
+    int _running;
+    uint64_t _start;
+    uint64_t _acc;
+};
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin, int value = 0) : _pin(pin), _value(value) {}
+
+    void write(int value) { _value = value ? 1 : 0; }
+    int read() { return _value; }
+
+    DigitalOut &operator=(int value)
+    {
+        write(value);
+        return *this;
+    }
+
+    DigitalOut &operator=(DigitalOut &rhs)
+    {
+        write(rhs.read());
+        return *this;
+    }
+
+    operator int() { return read(); }
+
+private:
+    PinName _pin;
+    int _value;
+};
+
+struct mbed_host_uart;
+
+/**
+ * @brief Serial port backed by a host file descriptor.
+ *
+ * The descriptor for a port is looked up the first time it is used:
+ * mbed_host_uart_bind() wins, then $MBED_HOST_UART_P<tx pin> (e.g.
+ * MBED_HOST_UART_P28), then $MBED_HOST_UART. Values are either "fd:<n>" or a
+ * device path such as a pty slave. Setting $MBED_HOST_UART_PACE=1 makes
+ * writeable() honour the configured baud rate like a real UART holding
+ * register; by default the link runs as fast as the descriptor allows.
+ *
+ * As on mbed-os, Serial and RawSerial are both a SerialBase. On the board
+ * only RawSerial may be used from an interrupt or a critical section, since
+ * Serial takes a mutex; the host versions are the same class either way.
+ */
+class SerialBase {
+public:
+    enum IrqType {
+        RxIrq = 0,
+        TxIrq,
+
+        IrqCnt
+    };
+
+    void baud(int baudrate);
+    int readable();
+    int writeable();
+    int putc(int c);
+    int getc();
+    int puts(const char *str);
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    void attach(Callback<void()> func, IrqType type = RxIrq);
+
+protected:
+    SerialBase(PinName tx, PinName rx, int baud);
+    ~SerialBase();
+
+private:
+    struct mbed_host_uart *_uart;
+};
+
+class Serial : public SerialBase {
+public:
+    Serial(PinName tx, PinName rx, const char *name = NULL, int baud = 9600);
+    Serial(PinName tx, PinName rx, int baud);
+};
+
+class RawSerial : public SerialBase {
+public:
+    RawSerial(PinName tx, PinName rx, int baud = 9600);
+};
+
+/**
+ * @brief Bind the serial port whose tx pin is @p tx to @p fd. Must be called
+ *        before the port is first used (i.e. before hdlc_init()).
+ */
+void mbed_host_uart_bind(PinName tx, int fd);
+
+#include "rtos.h"
+
+#endif /* MBED_HOST_MBED_H_ */
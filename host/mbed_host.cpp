@@ -0,0 +1,885 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        mbed_host.cpp
+ * @brief       pthread/fd backed implementation of the host mbed-os shims.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#include "mbed.h"
+#include "rtos.h"
+
+#define UART_RX_FIFO_SIZE   64
+#define UART_MAX_BINDINGS   8
+
+/*----------------------------------------------------------------------------
+ * time & critical section
+ *--------------------------------------------------------------------------*/
+
+uint64_t mbed_host_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void mbed_host_deadline(struct timespec *ts, uint32_t millisec)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += millisec / 1000;
+    ts->tv_nsec += (long)(millisec % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+void mbed_host_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static pthread_mutex_t critical_lock;
+static pthread_once_t critical_once = PTHREAD_ONCE_INIT;
+
+static void critical_init(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&critical_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void core_util_critical_section_enter(void)
+{
+    pthread_once(&critical_once, critical_init);
+    pthread_mutex_lock(&critical_lock);
+}
+
+void core_util_critical_section_exit(void)
+{
+    pthread_mutex_unlock(&critical_lock);
+}
+
+static void sleep_us(uint64_t us)
+{
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000ULL;
+    ts.tv_nsec = (long)(us % 1000000ULL) * 1000L;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+void wait(float s)
+{
+    sleep_us((uint64_t)(s * 1000000.0f));
+}
+
+void wait_ms(int ms)
+{
+    sleep_us((uint64_t)ms * 1000ULL);
+}
+
+void wait_us(int us)
+{
+    sleep_us((uint64_t)us);
+}
+
+/*----------------------------------------------------------------------------
+ * threads
+ *--------------------------------------------------------------------------*/
+
+struct mbed_host_thread {
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int32_t signals;
+};
+
+static __thread struct mbed_host_thread *current_thread;
+
+static struct mbed_host_thread *thread_new(void)
+{
+    struct mbed_host_thread *t = new mbed_host_thread;
+
+    pthread_mutex_init(&t->lock, NULL);
+    mbed_host_cond_init(&t->cond);
+    t->signals = 0;
+    return t;
+}
+
+osThreadId osThreadGetId(void)
+{
+    if (!current_thread) {
+        /* threads not created through Thread (e.g. main) get an id lazily */
+        current_thread = thread_new();
+        current_thread->tid = pthread_self();
+    }
+    return current_thread;
+}
+
+int32_t osSignalSet(osThreadId thread_id, int32_t signals)
+{
+    int32_t prev;
+
+    if (!thread_id) {
+        return (int32_t)0x80000000;
+    }
+    pthread_mutex_lock(&thread_id->lock);
+    prev = thread_id->signals;
+    thread_id->signals |= signals;
+    pthread_cond_signal(&thread_id->cond);
+    pthread_mutex_unlock(&thread_id->lock);
+    return prev;
+}
+
+Thread::Thread(osPriority priority, uint32_t stack_size,
+               unsigned char *stack_mem)
+    : _thread(NULL), _priority(priority)
+{
+    /* host stacks come from pthreads; the target sizing does not apply */
+    (void)stack_size;
+    (void)stack_mem;
+}
+
+Thread::~Thread()
+{
+}
+
+void *Thread::_thunk(void *arg)
+{
+    Thread *t = (Thread *)arg;
+
+    current_thread = t->_thread;
+    t->_task.call();
+    return NULL;
+}
+
+osStatus Thread::start(Callback<void()> task)
+{
+    if (_thread) {
+        return osErrorParameter;
+    }
+    _task = task;
+    _thread = thread_new();
+    if (pthread_create(&_thread->tid, NULL, _thunk, this)) {
+        delete _thread;
+        _thread = NULL;
+        return osErrorResource;
+    }
+    return osOK;
+}
+
+osStatus Thread::join()
+{
+    if (!_thread || pthread_join(_thread->tid, NULL)) {
+        return osErrorParameter;
+    }
+    return osOK;
+}
+
+osStatus Thread::set_priority(osPriority priority)
+{
+    /* priorities are recorded only; the host scheduler is left alone */
+    _priority = priority;
+    return osOK;
+}
+
+osPriority Thread::get_priority()
+{
+    return _priority;
+}
+
+int32_t Thread::signal_set(int32_t signals)
+{
+    return osSignalSet(_thread, signals);
+}
+
+/* CMSIS semantics: @p signals 0 waits for any flag and clears them all */
+osEvent Thread::signal_wait(int32_t signals, uint32_t millisec)
+{
+    struct mbed_host_thread *t = osThreadGetId();
+    struct timespec deadline;
+    osEvent evt;
+
+    if (millisec != osWaitForever) {
+        mbed_host_deadline(&deadline, millisec);
+    }
+
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+        if (signals == 0 ? t->signals != 0 :
+                           (t->signals & signals) == signals) {
+            evt.status = osEventSignal;
+            evt.value.signals = t->signals;
+            t->signals &= signals == 0 ? 0 : ~signals;
+            break;
+        }
+        if (millisec == 0) {
+            evt.status = osOK;
+            break;
+        }
+        if (millisec == osWaitForever) {
+            pthread_cond_wait(&t->cond, &t->lock);
+        } else if (pthread_cond_timedwait(&t->cond, &t->lock, &deadline)) {
+            evt.status = osEventTimeout;
+            if (signals == 0 ? t->signals == 0 :
+                               (t->signals & signals) != signals) {
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    return evt;
+}
+
+osStatus Thread::wait(uint32_t millisec)
+{
+    sleep_us((uint64_t)millisec * 1000ULL);
+    return osEventTimeout;
+}
+
+osStatus Thread::yield()
+{
+    sched_yield();
+    return osOK;
+}
+
+osThreadId Thread::gettid()
+{
+    return osThreadGetId();
+}
+
+/*----------------------------------------------------------------------------
+ * Semaphore & Mutex
+ *--------------------------------------------------------------------------*/
+
+Semaphore::Semaphore(int32_t count) : _count(count)
+{
+    pthread_mutex_init(&_lock, NULL);
+    mbed_host_cond_init(&_cond);
+}
+
+Semaphore::~Semaphore()
+{
+}
+
+int32_t Semaphore::wait(uint32_t millisec)
+{
+    struct timespec deadline;
+    int32_t tokens;
+
+    if (millisec != osWaitForever) {
+        mbed_host_deadline(&deadline, millisec);
+    }
+
+    pthread_mutex_lock(&_lock);
+    while (_count == 0) {
+        if (millisec == 0) {
+            break;
+        }
+        if (millisec == osWaitForever) {
+            pthread_cond_wait(&_cond, &_lock);
+        } else if (pthread_cond_timedwait(&_cond, &_lock, &deadline)) {
+            break;
+        }
+    }
+    /* CMSIS-RTOS v1: tokens available including the one taken, 0 on timeout */
+    tokens = _count;
+    if (_count > 0) {
+        _count--;
+    }
+    pthread_mutex_unlock(&_lock);
+    return tokens;
+}
+
+osStatus Semaphore::release(void)
+{
+    pthread_mutex_lock(&_lock);
+    _count++;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_lock);
+    return osOK;
+}
+
+Mutex::Mutex()
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+Mutex::~Mutex()
+{
+}
+
+osStatus Mutex::lock(uint32_t millisec)
+{
+    struct timespec deadline;
+
+    if (millisec == osWaitForever) {
+        pthread_mutex_lock(&_lock);
+        return osOK;
+    }
+    if (millisec == 0) {
+        return trylock() ? osOK : osErrorResource;
+    }
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += millisec / 1000;
+    deadline.tv_nsec += (long)(millisec % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return pthread_mutex_timedlock(&_lock, &deadline) ? osErrorTimeoutResource
+                                                      : osOK;
+}
+
+bool Mutex::trylock()
+{
+    return pthread_mutex_trylock(&_lock) == 0;
+}
+
+osStatus Mutex::unlock()
+{
+    pthread_mutex_unlock(&_lock);
+    return osOK;
+}
+
+/*----------------------------------------------------------------------------
+ * Serial
+ *--------------------------------------------------------------------------*/
+
+struct mbed_host_uart {
+    PinName tx;
+    int console;
+    int fd;
+    int eof;
+    int baud;
+    int pace;
+    uint64_t tx_free_at;
+    int is_sock;
+    int thr_full;           /* holding register waits for socket space */
+    unsigned char thr;
+    int tx_edge;            /* a tx-empty interrupt is due once writeable */
+
+    pthread_mutex_t lock;
+    unsigned char rx_fifo[UART_RX_FIFO_SIZE];
+    unsigned int rx_head;
+    unsigned int rx_count;
+
+    Callback<void()> irq[SerialBase::IrqCnt];
+    int irq_running;
+    pthread_t irq_thread;
+    int wake[2];
+};
+
+static struct {
+    PinName tx;
+    int fd;
+} uart_bindings[UART_MAX_BINDINGS];
+static int uart_num_bindings;
+
+void mbed_host_uart_bind(PinName tx, int fd)
+{
+    for (int i = 0; i < uart_num_bindings; i++) {
+        if (uart_bindings[i].tx == tx) {
+            uart_bindings[i].fd = fd;
+            return;
+        }
+    }
+    if (uart_num_bindings == UART_MAX_BINDINGS) {
+        fprintf(stderr, "mbed_host: too many uart bindings\n");
+        abort();
+    }
+    uart_bindings[uart_num_bindings].tx = tx;
+    uart_bindings[uart_num_bindings].fd = fd;
+    uart_num_bindings++;
+}
+
+static int uart_open_spec(const char *spec)
+{
+    struct termios tio;
+    int fd;
+
+    if (strncmp(spec, "fd:", 3) == 0) {
+        return atoi(spec + 3);
+    }
+
+    fd = open(spec, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(spec);
+        exit(1);
+    }
+    if (isatty(fd) && tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+static int fd_is_sock(int fd)
+{
+    struct stat st;
+
+    return fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+/* resolve the descriptor backing @p uart; called with uart->lock held */
+static int uart_fd(struct mbed_host_uart *uart)
+{
+    char name[32];
+    const char *spec;
+
+    if (uart->fd >= 0 || uart->console) {
+        return uart->fd;
+    }
+
+    /* a peer that exits must show up as a write error, not kill us */
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < uart_num_bindings; i++) {
+        if (uart_bindings[i].tx == uart->tx) {
+            uart->fd = uart_bindings[i].fd;
+            uart->is_sock = fd_is_sock(uart->fd);
+            return uart->fd;
+        }
+    }
+
+    snprintf(name, sizeof(name), "MBED_HOST_UART_P%d", (int)uart->tx);
+    spec = getenv(name);
+    if (!spec) {
+        spec = getenv("MBED_HOST_UART");
+    }
+    if (!spec) {
+        fprintf(stderr, "mbed_host: no descriptor for serial p%d, set %s or "
+                "MBED_HOST_UART\n", (int)uart->tx, name);
+        exit(1);
+    }
+    uart->fd = uart_open_spec(spec);
+    uart->is_sock = fd_is_sock(uart->fd);
+    return uart->fd;
+}
+
+/**
+ * Pass one character to the descriptor; lock held. Sockets are written
+ * without blocking and report 0 when full so the character can wait in the
+ * holding register instead of stalling an emulated isr.
+ */
+static int uart_xmit(struct mbed_host_uart *uart, unsigned char byte)
+{
+    ssize_t n;
+
+    do {
+        n = send(uart_fd(uart), &byte, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n == 1) {
+        return 1;
+    }
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+}
+
+/**
+ * Wait up to a millisecond for room and push the holding register out. The
+ * real transmitter empties it by itself, so a putc() spinning inside a
+ * critical section must not depend on the irq thread, which cannot get in.
+ */
+static void uart_drain_thr(struct mbed_host_uart *uart)
+{
+    struct pollfd pfd;
+
+    pthread_mutex_lock(&uart->lock);
+    if (uart->thr_full) {
+        pfd.fd = uart_fd(uart);
+        pfd.events = POLLOUT;
+        pthread_mutex_unlock(&uart->lock);
+        (void)poll(&pfd, 1, 1);
+        pthread_mutex_lock(&uart->lock);
+        if (uart->thr_full && uart_xmit(uart, uart->thr) != 0) {
+            uart->thr_full = 0;
+        }
+    }
+    pthread_mutex_unlock(&uart->lock);
+}
+
+/* pull whatever the descriptor has into the rx fifo; lock held */
+static void uart_fill(struct mbed_host_uart *uart, int blocking)
+{
+    ssize_t n;
+    int fd = uart_fd(uart);
+
+    if (uart->rx_count > 0 || uart->eof) {
+        return;
+    }
+    if (!blocking) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 0) <= 0) {
+            return;
+        }
+    }
+    do {
+        n = read(fd, uart->rx_fifo, sizeof(uart->rx_fifo));
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        uart->eof = 1;
+        return;
+    }
+    uart->rx_head = 0;
+    uart->rx_count = (unsigned int)n;
+}
+
+static void uart_wake(struct mbed_host_uart *uart)
+{
+    char c = 0;
+
+    if (uart->irq_running) {
+        (void)!write(uart->wake[1], &c, 1);
+    }
+}
+
+/**
+ * emulated uart interrupt. Rx is level triggered (fires while data is
+ * pending); tx-empty fires once after each putc, when the transmitter can
+ * take the next character, and once on attach, like the LPC17xx THRE source.
+ */
+static void *uart_irq_thread(void *arg)
+{
+    struct mbed_host_uart *uart = (struct mbed_host_uart *)arg;
+    struct pollfd pfd[2];
+    struct timespec ts;
+    struct timespec *timeout;
+    uint64_t now;
+    int rx_on, tx_on, tx_due;
+    unsigned int rx_before;
+
+    /* character times are ~87 us at 115200; default 50 us slack distorts them */
+    prctl(PR_SET_TIMERSLACK, 1UL);
+
+    for (;;) {
+        pthread_mutex_lock(&uart->lock);
+        rx_on = uart->irq[SerialBase::RxIrq] ? 1 : 0;
+        tx_on = uart->irq[SerialBase::TxIrq] ? 1 : 0;
+        tx_due = tx_on && uart->tx_edge && !uart->thr_full;
+
+        pfd[0].fd = uart->wake[0];
+        pfd[0].events = POLLIN;
+        pfd[1].fd = uart_fd(uart);
+        pfd[1].events = 0;
+        pfd[1].revents = 0;
+        if (rx_on && uart->rx_count == 0 && !uart->eof) {
+            pfd[1].events |= POLLIN;
+        }
+        if (uart->thr_full) {
+            pfd[1].events |= POLLOUT;
+        }
+
+        timeout = NULL;
+        now = mbed_host_time_us();
+        if ((rx_on && uart->rx_count > 0) || tx_due) {
+            ts.tv_sec = 0;
+            ts.tv_nsec = 0;
+            if (!(rx_on && uart->rx_count > 0) && uart->pace &&
+                uart->tx_free_at > now) {
+                /* tx-empty comes one character time after the last putc */
+                ts.tv_sec = (uart->tx_free_at - now) / 1000000ULL;
+                ts.tv_nsec = (long)((uart->tx_free_at - now) % 1000000ULL) * 1000L;
+            }
+            timeout = &ts;
+        }
+        pthread_mutex_unlock(&uart->lock);
+
+        if (ppoll(pfd, pfd[1].events ? 2 : 1, timeout, NULL) < 0 &&
+            errno != EINTR) {
+            perror("mbed_host: ppoll");
+            return NULL;
+        }
+        if (pfd[0].revents & POLLIN) {
+            char buf[16];
+            (void)!read(uart->wake[0], buf, sizeof(buf));
+        }
+
+        pthread_mutex_lock(&uart->lock);
+        if ((pfd[1].events & POLLIN) &&
+            (pfd[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            uart_fill(uart, 0);
+        }
+        if (uart->thr_full && (pfd[1].revents & (POLLOUT | POLLERR | POLLHUP)) &&
+            uart_xmit(uart, uart->thr) != 0) {
+            uart->thr_full = 0;
+        }
+        rx_before = uart->rx_count;
+        tx_due = tx_on && uart->tx_edge && !uart->thr_full &&
+                 (!uart->pace || mbed_host_time_us() >= uart->tx_free_at);
+        if (tx_due) {
+            uart->tx_edge = 0;
+        }
+        pthread_mutex_unlock(&uart->lock);
+
+        core_util_critical_section_enter();
+        if (rx_on && rx_before > 0) {
+            uart->irq[SerialBase::RxIrq].call();
+        }
+        if (tx_due && uart->irq[SerialBase::TxIrq]) {
+            uart->irq[SerialBase::TxIrq].call();
+        }
+        core_util_critical_section_exit();
+
+        /* a handler that leaves data behind must not spin the host cpu */
+        if (rx_on && rx_before > 0 && uart->rx_count == rx_before) {
+            sleep_us(1000);
+        }
+    }
+    return NULL;
+}
+
+static struct mbed_host_uart *uart_new(PinName tx, int baud)
+{
+    struct mbed_host_uart *uart = new mbed_host_uart;
+
+    uart->tx = tx;
+    uart->console = (tx == USBTX);
+    uart->fd = uart->console ? STDOUT_FILENO : -1;
+    uart->eof = 0;
+    uart->baud = baud;
+    uart->pace = getenv("MBED_HOST_UART_PACE") &&
+                 atoi(getenv("MBED_HOST_UART_PACE"));
+    uart->tx_free_at = 0;
+    uart->is_sock = 0;
+    uart->thr_full = 0;
+    uart->tx_edge = 0;
+    uart->rx_head = 0;
+    uart->rx_count = 0;
+    uart->irq_running = 0;
+    pthread_mutex_init(&uart->lock, NULL);
+    return uart;
+}
+
+SerialBase::SerialBase(PinName tx, PinName rx, int baud)
+{
+    (void)rx;
+    _uart = uart_new(tx, baud);
+}
+
+SerialBase::~SerialBase()
+{
+}
+
+Serial::Serial(PinName tx, PinName rx, const char *name, int baud)
+    : SerialBase(tx, rx, baud)
+{
+    (void)name;
+}
+
+Serial::Serial(PinName tx, PinName rx, int baud)
+    : SerialBase(tx, rx, baud)
+{
+}
+
+RawSerial::RawSerial(PinName tx, PinName rx, int baud)
+    : SerialBase(tx, rx, baud)
+{
+}
+
+void SerialBase::baud(int baudrate)
+{
+    _uart->baud = baudrate;
+}
+
+int SerialBase::readable()
+{
+    int ret;
+
+    if (_uart->console) {
+        return 0;
+    }
+    pthread_mutex_lock(&_uart->lock);
+    if (!_uart->irq_running) {
+        uart_fill(_uart, 0);
+    }
+    ret = _uart->rx_count > 0;
+    pthread_mutex_unlock(&_uart->lock);
+    return ret;
+}
+
+int SerialBase::writeable()
+{
+    if (_uart->pace && mbed_host_time_us() < _uart->tx_free_at) {
+        return 0;
+    }
+    return !_uart->thr_full;
+}
+
+int SerialBase::putc(int c)
+{
+    unsigned char byte = (unsigned char)c;
+    int n, fd, wake;
+
+    while (!writeable()) {
+        uart_drain_thr(_uart);
+    }
+
+    pthread_mutex_lock(&_uart->lock);
+    fd = uart_fd(_uart);
+    if (_uart->is_sock) {
+        n = uart_xmit(_uart, byte);
+        if (n == 0) {
+            _uart->thr = byte;
+            _uart->thr_full = 1;
+            n = 1;
+        }
+    } else {
+        /* ttys and the console just block, outside the lock */
+        pthread_mutex_unlock(&_uart->lock);
+        do {
+            n = (int)write(fd, &byte, 1);
+        } while (n < 0 && errno == EINTR);
+        pthread_mutex_lock(&_uart->lock);
+    }
+    if (_uart->pace && _uart->baud > 0) {
+        uint64_t now = mbed_host_time_us();
+        if (_uart->tx_free_at < now) {
+            _uart->tx_free_at = now;
+        }
+        /* 8N1: ten bit times per character */
+        _uart->tx_free_at += 10000000ULL / (uint64_t)_uart->baud;
+    }
+    _uart->tx_edge = 1;
+    wake = _uart->thr_full || _uart->irq[TxIrq];
+    pthread_mutex_unlock(&_uart->lock);
+    if (wake) {
+        uart_wake(_uart);
+    }
+    return n == 1 ? c : -1;
+}
+
+int SerialBase::getc()
+{
+    int c = -1;
+
+    for (;;) {
+        pthread_mutex_lock(&_uart->lock);
+        if (_uart->rx_count == 0 && !_uart->irq_running) {
+            uart_fill(_uart, 1);
+        }
+        if (_uart->rx_count > 0) {
+            c = _uart->rx_fifo[_uart->rx_head++];
+            _uart->rx_count--;
+        }
+        if (c >= 0 || _uart->eof) {
+            pthread_mutex_unlock(&_uart->lock);
+            return c;
+        }
+        pthread_mutex_unlock(&_uart->lock);
+        sleep_us(100);
+    }
+}
+
+int SerialBase::puts(const char *str)
+{
+    int n = 0;
+
+    while (*str) {
+        putc(*str++);
+        n++;
+    }
+    return n;
+}
+
+int SerialBase::printf(const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    int n;
+
+    va_start(args, format);
+    if (_uart->console) {
+        n = vprintf(format, args);
+        fflush(stdout);
+        va_end(args);
+        return n;
+    }
+    n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    puts(buf);
+    return n;
+}
+
+void SerialBase::attach(Callback<void()> func, IrqType type)
+{
+    if (_uart->console) {
+        return;
+    }
+
+    core_util_critical_section_enter();
+    pthread_mutex_lock(&_uart->lock);
+    _uart->irq[type] = func;
+    if (type == TxIrq) {
+        _uart->tx_edge = 1;
+    }
+    if (!_uart->irq_running) {
+        uart_fd(_uart);
+        if (pipe(_uart->wake) < 0) {
+            perror("mbed_host: pipe");
+            exit(1);
+        }
+        fcntl(_uart->wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(_uart->wake[1], F_SETFL, O_NONBLOCK);
+        _uart->irq_running = 1;
+        pthread_create(&_uart->irq_thread, NULL, uart_irq_thread, _uart);
+    }
+    pthread_mutex_unlock(&_uart->lock);
+    uart_wake(_uart);
+    core_util_critical_section_exit();
+}
@@ -0,0 +1,322 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        rtos.h
+ * @brief       Host (POSIX) stand-in for the subset of mbed-os rtos used by
+ *              hdlc: Thread, Mail, MemoryPool, Semaphore and Mutex on top
+ *              of pthreads.
+ *
+ * Return values follow the CMSIS-RTOS v1 conventions the mbed 5 wrappers
+ * expose so that code written against the target behaves the same here.
+ */
+
+#ifndef MBED_HOST_RTOS_H_
+#define MBED_HOST_RTOS_H_
+
+#include "mbed.h"
+#include <pthread.h>
+
+#define osWaitForever       0xFFFFFFFFU
+#define DEFAULT_STACK_SIZE  2048
+
+typedef enum {
+    osOK                    = 0,
+    osEventSignal           = 0x08,
+    osEventMessage          = 0x10,
+    osEventMail             = 0x20,
+    osEventTimeout          = 0x40,
+    osErrorParameter        = 0x80,
+    osErrorResource         = 0x81,
+    osErrorTimeoutResource  = 0xC1,
+    osErrorISR              = 0x82,
+    osErrorValue            = 0x86,
+    osErrorOS               = 0xFF
+} osStatus;
+
+typedef enum {
+    osPriorityIdle          = -3,
+    osPriorityLow           = -2,
+    osPriorityBelowNormal   = -1,
+    osPriorityNormal        =  0,
+    osPriorityAboveNormal   = +1,
+    osPriorityHigh          = +2,
+    osPriorityRealtime      = +3,
+    osPriorityError         = 0x84
+} osPriority;
+
+typedef struct {
+    osStatus status;
+    union {
+        uint32_t v;
+        void *p;
+        int32_t signals;
+    } value;
+} osEvent;
+
+typedef struct mbed_host_thread *osThreadId;
+
+osThreadId osThreadGetId(void);
+int32_t osSignalSet(osThreadId thread_id, int32_t signals);
+
+/* absolute CLOCK_MONOTONIC deadline @p millisec from now */
+void mbed_host_deadline(struct timespec *ts, uint32_t millisec);
+/* pthread_cond_t that waits against CLOCK_MONOTONIC */
+void mbed_host_cond_init(pthread_cond_t *cond);
+
+class Thread {
+public:
+    Thread(osPriority priority = osPriorityNormal,
+           uint32_t stack_size = DEFAULT_STACK_SIZE,
+           unsigned char *stack_mem = NULL);
+    ~Thread();
+
+    osStatus start(Callback<void()> task);
+    osStatus join();
+    osStatus set_priority(osPriority priority);
+    osPriority get_priority();
+
+    int32_t signal_set(int32_t signals);
+
+    static osEvent signal_wait(int32_t signals,
+                               uint32_t millisec = osWaitForever);
+    static osStatus wait(uint32_t millisec);
+    static osStatus yield();
+    static osThreadId gettid();
+
+private:
+    static void *_thunk(void *thread);
+
+    struct mbed_host_thread *_thread;
+    osPriority _priority;
+    Callback<void()> _task;
+};
+
+class Semaphore {
+public:
+    Semaphore(int32_t count = 0);
+    ~Semaphore();
+
+    int32_t wait(uint32_t millisec = osWaitForever);
+    osStatus release(void);
+
+private:
+    pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+    int32_t _count;
+};
+
+class Mutex {
+public:
+    Mutex();
+    ~Mutex();
+
+    osStatus lock(uint32_t millisec = osWaitForever);
+    bool trylock();
+    osStatus unlock();
+
+private:
+    pthread_mutex_t _lock;
+};
+
+/**
+ * @brief Fixed size block pool; alloc() never blocks, free() rejects
+ *        pointers that did not come from this pool.
+ */
+template <typename T, uint32_t pool_sz>
+class MemoryPool {
+public:
+    MemoryPool() : _free_top(pool_sz)
+    {
+        pthread_mutex_init(&_lock, NULL);
+        for (uint32_t i = 0; i < pool_sz; i++) {
+            _free[i] = &_pool[pool_sz - 1 - i];
+        }
+    }
+
+    T *alloc(void)
+    {
+        T *block = NULL;
+
+        pthread_mutex_lock(&_lock);
+        if (_free_top > 0) {
+            block = _free[--_free_top];
+        }
+        pthread_mutex_unlock(&_lock);
+        return block;
+    }
+
+    T *calloc(void)
+    {
+        T *block = alloc();
+
+        if (block) {
+            memset((void *)block, 0, sizeof(T));
+        }
+        return block;
+    }
+
+    osStatus free(T *block)
+    {
+        if (block < &_pool[0] || block >= &_pool[pool_sz]) {
+            return osErrorValue;
+        }
+        pthread_mutex_lock(&_lock);
+        _free[_free_top++] = block;
+        pthread_mutex_unlock(&_lock);
+        return osOK;
+    }
+
+private:
+    pthread_mutex_t _lock;
+    T _pool[pool_sz];
+    T *_free[pool_sz];
+    uint32_t _free_top;
+};
+
+/**
+ * @brief Fixed size mail queue: a pool of @p queue_sz items plus a FIFO of
+ *        pointers into it. alloc() never blocks, like the target.
+ */
+template <typename T, uint32_t queue_sz>
+class Mail {
+public:
+    Mail() : _free_top(queue_sz), _head(0), _count(0)
+    {
+        pthread_mutex_init(&_lock, NULL);
+        mbed_host_cond_init(&_cond);
+        for (uint32_t i = 0; i < queue_sz; i++) {
+            _free[i] = &_pool[queue_sz - 1 - i];
+        }
+    }
+
+    T *alloc(uint32_t millisec = 0)
+    {
+        T *mptr = NULL;
+
+        (void)millisec;
+        pthread_mutex_lock(&_lock);
+        if (_free_top > 0) {
+            mptr = _free[--_free_top];
+        }
+        pthread_mutex_unlock(&_lock);
+        return mptr;
+    }
+
+    T *calloc(uint32_t millisec = 0)
+    {
+        T *mptr = alloc(millisec);
+
+        if (mptr) {
+            memset((void *)mptr, 0, sizeof(T));
+        }
+        return mptr;
+    }
+
+    osStatus put(T *mptr)
+    {
+        if (!owns(mptr)) {
+            return osErrorParameter;
+        }
+        pthread_mutex_lock(&_lock);
+        _queue[(_head + _count) % queue_sz] = mptr;
+        _count++;
+        pthread_cond_signal(&_cond);
+        pthread_mutex_unlock(&_lock);
+        return osOK;
+    }
+
+    osEvent get(uint32_t millisec = osWaitForever)
+    {
+        osEvent evt;
+        struct timespec deadline;
+
+        if (millisec != osWaitForever) {
+            mbed_host_deadline(&deadline, millisec);
+        }
+
+        pthread_mutex_lock(&_lock);
+        while (_count == 0) {
+            if (millisec == 0) {
+                pthread_mutex_unlock(&_lock);
+                evt.status = osOK;
+                evt.value.p = NULL;
+                return evt;
+            }
+            if (millisec == osWaitForever) {
+                pthread_cond_wait(&_cond, &_lock);
+            } else if (pthread_cond_timedwait(&_cond, &_lock, &deadline)) {
+                if (_count == 0) {
+                    pthread_mutex_unlock(&_lock);
+                    evt.status = osEventTimeout;
+                    evt.value.p = NULL;
+                    return evt;
+                }
+            }
+        }
+        evt.status = osEventMail;
+        evt.value.p = _queue[_head];
+        _head = (_head + 1) % queue_sz;
+        _count--;
+        pthread_mutex_unlock(&_lock);
+        return evt;
+    }
+
+    osStatus free(T *mptr)
+    {
+        if (!owns(mptr)) {
+            return osErrorValue;
+        }
+        pthread_mutex_lock(&_lock);
+        _free[_free_top++] = mptr;
+        pthread_mutex_unlock(&_lock);
+        return osOK;
+    }
+
+private:
+    bool owns(T *mptr)
+    {
+        return mptr >= &_pool[0] && mptr < &_pool[queue_sz];
+    }
+
+    pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+    T _pool[queue_sz];
+    T *_free[queue_sz];
+    uint32_t _free_top;
+    T *_queue[queue_sz];
+    uint32_t _head;
+    uint32_t _count;
+};
+
+#endif /* MBED_HOST_RTOS_H_ */
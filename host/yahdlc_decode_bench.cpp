@@ -0,0 +1,215 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        yahdlc_decode_bench.cpp
+ * @brief       Decode throughput of yahdlc, byte at a time vs. span based.
+ *
+ * Usage: yahdlc_decode_bench [frames] [chunk]
+ *
+ * Frames @p frames (default 20000) random data frames of up to
+ * HDLC_MAX_PKT_SIZE bytes back to back and decodes the stream three times:
+ * the way _hdlc_receive() used to (pop one byte from a critical-section
+ * guarded ring, take recv_buf_mutex, call yahdlc_get_data() on it), with the
+ * bare yahdlc_get_data() calls alone, and with yahdlc_get_data_span() in
+ * @p chunk byte pieces (default 512, the size of the hdlc receive ring).
+ * Every pass must give back exactly the frames that were encoded; the
+ * program exits non-zero if one does not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mbed.h"
+#include "rtos.h"
+#include "hdlc.h"
+#include "yahdlc.h"
+
+typedef struct {
+    unsigned int offset, length;
+} bench_frame_t;
+
+static char *stream, *payloads;
+static bench_frame_t *frames;
+static unsigned int stream_len, nframes;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check_frame(unsigned int *n, yahdlc_control_t *control,
+                       const char *data, unsigned int len)
+{
+    bench_frame_t *f = &frames[*n < nframes ? *n : 0];
+
+    if (*n >= nframes || control->frame != YAHDLC_FRAME_DATA ||
+        control->seq_no != *n % 8 || len != f->length ||
+        memcmp(data, payloads + f->offset, len) != 0) {
+        fprintf(stderr, "frame %u decoded wrong\n", *n);
+        return -1;
+    }
+    (*n)++;
+    return 0;
+}
+
+/* stand-in for the CircularBuffer::pop() the old receive path did per byte */
+static bool ring_pop(unsigned int *tail, char *c)
+{
+    bool popped = false;
+
+    core_util_critical_section_enter();
+    if (*tail < stream_len) {
+        *c = stream[(*tail)++];
+        popped = true;
+    }
+    core_util_critical_section_exit();
+    return popped;
+}
+
+static int decode_bytewise(bool rx_path)
+{
+    char dest[HDLC_MAX_PKT_SIZE + 2];
+    yahdlc_control_t control;
+    Semaphore recv_buf_mutex(1);
+    unsigned int len, n = 0, tail = 0;
+    int ret;
+    char c;
+
+    yahdlc_get_data_reset();
+    for (unsigned int i = 0; i < stream_len; i++) {
+        if (rx_path) {
+            ring_pop(&tail, &c);
+            recv_buf_mutex.wait();
+            ret = yahdlc_get_data(&control, &c, 1, dest, &len);
+            recv_buf_mutex.release();
+        } else {
+            ret = yahdlc_get_data(&control, &stream[i], 1, dest, &len);
+        }
+        if (ret >= 0 && check_frame(&n, &control, dest, len) < 0) {
+            return -1;
+        }
+    }
+    return n == nframes ? 0 : -1;
+}
+
+static int decode_span(unsigned int chunk)
+{
+    char dest[HDLC_MAX_PKT_SIZE + 2];
+    yahdlc_state_t state;
+    yahdlc_control_t control;
+    unsigned int off = 0, len, used, n = 0;
+    int ret;
+
+    yahdlc_get_data_reset_with_state(&state);
+    while (off < stream_len) {
+        len = stream_len - off < chunk ? stream_len - off : chunk;
+        ret = yahdlc_get_data_span(&state, &control, stream + off, len, dest,
+                                   sizeof(dest), &len, &used);
+        off += used;
+        if (ret == 0 && check_frame(&n, &control, dest, len) < 0) {
+            return -1;
+        }
+        if (ret == -EIO) {
+            fprintf(stderr, "frame %u rejected\n", n);
+            return -1;
+        }
+    }
+    return n == nframes ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int chunk;
+    unsigned int payload_len = 0;
+    yahdlc_control_t control;
+    double t0, t_path, t_byte, t_span;
+    int ret = 0;
+
+    nframes = argc > 1 ? atoi(argv[1]) : 20000;
+    chunk = argc > 2 ? atoi(argv[2]) : 512;
+    if (nframes == 0 || chunk == 0) {
+        fprintf(stderr, "usage: %s [frames] [chunk]\n", argv[0]);
+        return 2;
+    }
+
+    frames = (bench_frame_t *)calloc(nframes, sizeof(*frames));
+    payloads = (char *)malloc((size_t)nframes * HDLC_MAX_PKT_SIZE);
+    stream = (char *)malloc((size_t)nframes * 2 * (HDLC_MAX_PKT_SIZE + 6));
+    srand(1);
+    for (unsigned int n = 0; n < nframes; n++) {
+        unsigned int framed;
+
+        frames[n].offset = payload_len;
+        frames[n].length = 1 + rand() % HDLC_MAX_PKT_SIZE;
+        for (unsigned int i = 0; i < frames[n].length; i++) {
+            payloads[payload_len + i] = (char)rand();
+        }
+        control.frame = YAHDLC_FRAME_DATA;
+        control.seq_no = n % 8;
+        control.recv_seq_no = 0;
+        yahdlc_frame_data(&control, payloads + payload_len, frames[n].length,
+                          stream + stream_len, &framed);
+        payload_len += frames[n].length;
+        stream_len += framed;
+    }
+
+    t0 = now_sec();
+    if (decode_bytewise(true) < 0) {
+        ret = 1;
+    }
+    t_path = now_sec() - t0;
+
+    t0 = now_sec();
+    if (decode_bytewise(false) < 0) {
+        ret = 1;
+    }
+    t_byte = now_sec() - t0;
+
+    t0 = now_sec();
+    if (decode_span(chunk) < 0) {
+        ret = 1;
+    }
+    t_span = now_sec() - t0;
+
+    printf("%u frames, %u bytes: old rx path %.1f MB/s, bytewise %.1f MB/s, "
+           "span/%u %.1f MB/s (%.1fx, %.1fx)%s\n", nframes, stream_len,
+           stream_len / t_path / 1e6, stream_len / t_byte / 1e6, chunk,
+           stream_len / t_span / 1e6, t_path / t_span, t_byte / t_span,
+           ret ? ", MISMATCH" : "");
+    return ret;
+}
@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2017, Autonomous Networks Research Group. All rights reserved.
+ * Developed by:
+ * Autonomous Networks Research Group (ANRG)
+ * University of Southern California
+ * http://anrg.usc.edu/
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * with the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * - Redistributions of source code must retain the above copyright notice, this
+ *     list of conditions and the following disclaimers.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *     this list of conditions and the following disclaimers in the
+ *     documentation and/or other materials provided with the distribution.
+ * - Neither the names of Autonomous Networks Research Group, nor University of
+ *     Southern California, nor the names of its contributors may be used to
+ *     endorse or promote products derived from this Software without specific
+ *     prior written permission.
+ * - A citation to the Autonomous Networks Research Group must be included in
+ *     any publications benefiting from the use of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file        yahdlc_encode_bench.cpp
+ * @brief       Frame encoding cost, staged packet vs. scatter list vs.
+ *              streamed into a tx ring.
+ *
+ * Usage: yahdlc_encode_bench [frames]
+ *
+ * Encodes @p frames (default 200000) packets of a uart_pkt_hdr_t and an
+ * mqtt_pkt_t three ways: the way senders used to, uart_pkt_insert_hdr() and
+ * uart_pkt_cpy_data() into a send_data[HDLC_MAX_PKT_SIZE] and then
+ * yahdlc_frame_data(); with yahdlc_frame_data_iov() straight from the two
+ * structs; and with yahdlc_encode() into a HDLC_TX_RING_SIZE byte ring, as
+ * _hdlc_write_frame() does, wrapping where the ring does. It reports the
+ * best of BENCH_RUNS runs of each. All must give the same frame, byte for
+ * byte, also when yahdlc_encode() is handed 1..16 bytes of room at a time;
+ * the program exits non-zero if they do not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mbed.h"
+#include "rtos.h"
+#include "hdlc.h"
+#include "yahdlc.h"
+
+#define BENCH_FRAME_SIZE    (2 * (HDLC_MAX_PKT_SIZE + 2 + 2 + 2))
+#define BENCH_RUNS          5
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(mqtt_pkt_t *mqtt, uart_pkt_hdr_t *hdr, unsigned int n)
+{
+    hdr->src_port = 1000 + n % 7;
+    hdr->dst_port = 2000;
+    hdr->pkt_type = MQTT_PUB;
+    for (unsigned int i = 0; i < sizeof(*mqtt); i++) {
+        /* now and then a flag or escape to stuff */
+        ((char *)mqtt)[i] = (char)(n * 31 + i * 7);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char send_data[HDLC_MAX_PKT_SIZE];
+    char staged[BENCH_FRAME_SIZE], gathered[BENCH_FRAME_SIZE];
+    unsigned int staged_len, gathered_len, nframes;
+    unsigned long sink = 0;
+    yahdlc_control_t control;
+    yahdlc_iovec_t iov[2];
+    uart_pkt_hdr_t hdr;
+    mqtt_pkt_t mqtt;
+    yahdlc_encoder_t enc;
+    char ring[HDLC_TX_RING_SIZE];
+    unsigned int head = 0, room, len;
+    double t0, t, t_staged = 1e9, t_iov = 1e9, t_ring = 1e9;
+    int ret = 0;
+
+    nframes = argc > 1 ? atoi(argv[1]) : 200000;
+    if (nframes == 0) {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 2;
+    }
+    control.frame = YAHDLC_FRAME_DATA;
+    control.recv_seq_no = 0;
+    iov[0].base = &hdr;
+    iov[0].len = UART_PKT_HDR_LEN;
+    iov[1].base = &mqtt;
+    iov[1].len = sizeof(mqtt);
+
+    /* same frames both ways */
+    for (unsigned int n = 0; n < 256; n++) {
+        fill(&mqtt, &hdr, n);
+        control.seq_no = n % 8;
+        uart_pkt_cpy_data(send_data, sizeof(send_data), &mqtt, sizeof(mqtt));
+        uart_pkt_insert_hdr(send_data, sizeof(send_data), &hdr);
+        yahdlc_frame_data(&control, send_data, UART_PKT_HDR_LEN + sizeof(mqtt),
+                          staged, &staged_len);
+        yahdlc_frame_data_iov(&control, iov, 2, gathered, &gathered_len);
+        if (staged_len != gathered_len ||
+            memcmp(staged, gathered, staged_len) != 0) {
+            fprintf(stderr, "frame %u encoded differently\n", n);
+            ret = 1;
+        }
+        /* a little room at a time, splitting escapes too */
+        yahdlc_encode_init(&enc, &control, iov, 2);
+        gathered_len = 0;
+        while (!yahdlc_encode_done(&enc)) {
+            room = 1 + (n + gathered_len) % 16;
+            gathered_len += yahdlc_encode(&enc, gathered + gathered_len,
+                sizeof(gathered) - gathered_len < room ?
+                sizeof(gathered) - gathered_len : room);
+        }
+        if (staged_len != gathered_len ||
+            memcmp(staged, gathered, staged_len) != 0) {
+            fprintf(stderr, "frame %u streamed differently\n", n);
+            ret = 1;
+        }
+    }
+
+    fill(&mqtt, &hdr, 1);
+    for (unsigned int run = 0; run < BENCH_RUNS; run++) {
+        t0 = now_sec();
+        for (unsigned int n = 0; n < nframes; n++) {
+            control.seq_no = n % 8;
+            uart_pkt_cpy_data(send_data, sizeof(send_data), &mqtt,
+                              sizeof(mqtt));
+            uart_pkt_insert_hdr(send_data, sizeof(send_data), &hdr);
+            yahdlc_frame_data(&control, send_data,
+                              UART_PKT_HDR_LEN + sizeof(mqtt), staged,
+                              &staged_len);
+            sink += staged[staged_len / 2];
+        }
+        t = now_sec() - t0;
+        t_staged = t < t_staged ? t : t_staged;
+
+        t0 = now_sec();
+        for (unsigned int n = 0; n < nframes; n++) {
+            control.seq_no = n % 8;
+            yahdlc_frame_data_iov(&control, iov, 2, gathered, &gathered_len);
+            sink += gathered[gathered_len / 2];
+        }
+        t = now_sec() - t0;
+        t_iov = t < t_iov ? t : t_iov;
+
+        t0 = now_sec();
+        for (unsigned int n = 0; n < nframes; n++) {
+            control.seq_no = n % 8;
+            yahdlc_encode_init(&enc, &control, iov, 2);
+            do {
+                room = HDLC_TX_RING_SIZE - head;
+                len = yahdlc_encode(&enc, &ring[head], room);
+                head = (head + len) % HDLC_TX_RING_SIZE;
+            } while (!yahdlc_encode_done(&enc));
+            sink += ring[head / 2];
+        }
+        t = now_sec() - t0;
+        t_ring = t < t_ring ? t : t_ring;
+    }
+
+    printf("%u frames of %u bytes: staged %.1f ns/frame, iov %.1f ns/frame "
+           "(%.2fx), ring %.1f ns/frame (%.2fx)%s\n", nframes,
+           (unsigned int)(UART_PKT_HDR_LEN + sizeof(mqtt)),
+           t_staged / nframes * 1e9, t_iov / nframes * 1e9, t_staged / t_iov,
+           t_ring / nframes * 1e9, t_staged / t_ring,
+           ret ? ", MISMATCH" : "");
+    return ret | (sink == 1);
+}
@@ -28,6 +28,7 @@
 #include "fcs16.h"
 #include "yahdlc.h"
 #include <errno.h>
+#include <string.h>
 #include "hdlc.h"
 #include "mbed.h"
 #include "rtos.h"
@@ -45,6 +46,9 @@
 #define YAHDLC_CONTROL_TYPE_REJECT 2
 #define YAHDLC_CONTROL_TYPE_SELECTIVE_REJECT 3
 
+// U-frame control values (Poll/Final bit cleared)
+#define YAHDLC_CONTROL_UNNUMBERED_INFO 0x03
+
 static yahdlc_state_t yahdlc_state = {
     .control_escape = 0,
     .fcs = FCS16_INIT_VALUE,
@@ -87,23 +91,37 @@ void yahdlc_escape_value(char value, char *dest, int *dest_index) {
 yahdlc_control_t yahdlc_get_control_type(unsigned char control) {
   yahdlc_control_t value;
 
-  // Check if the frame is a S-frame (or U-frame)
-  if (control & (1 << YAHDLC_CONTROL_S_OR_U_FRAME_BIT)) {
-    // Check if S-frame type is a Receive Ready (ACK)
-    if (((control >> YAHDLC_CONTROL_S_FRAME_TYPE_BIT) & 0x3)
-        == YAHDLC_CONTROL_TYPE_RECEIVE_READY) {
-      value.frame = YAHDLC_FRAME_ACK;
-    } else {
-      // Assume it is an NACK since Receive Not Ready, Selective Reject and U-frames are not supported
-      value.frame = YAHDLC_FRAME_NACK;
+  if ((control & ~(1 << YAHDLC_CONTROL_POLL_BIT)) == YAHDLC_CONTROL_UNNUMBERED_INFO) {
+    // Unnumbered Information: data without sequence numbers
+    value.frame = YAHDLC_FRAME_UI;
+    value.seq_no = 0;
+    value.recv_seq_no = 0;
+  } else if (control & (1 << YAHDLC_CONTROL_S_OR_U_FRAME_BIT)) {
+    // An S-frame (or another U-frame)
+    switch ((control >> YAHDLC_CONTROL_S_FRAME_TYPE_BIT) & 0x3) {
+      case YAHDLC_CONTROL_TYPE_RECEIVE_READY:
+        value.frame = YAHDLC_FRAME_ACK;
+        break;
+      case YAHDLC_CONTROL_TYPE_RECEIVE_NOT_READY:
+        value.frame = YAHDLC_FRAME_RNR;
+        break;
+      case YAHDLC_CONTROL_TYPE_SELECTIVE_REJECT:
+        value.frame = YAHDLC_FRAME_SREJ;
+        break;
+      default:
+        // Reject (other U-frames are not supported)
+        value.frame = YAHDLC_FRAME_NACK;
+        break;
     }
 
     // Add the receive sequence number from the S-frame (or U-frame)
     value.seq_no = (control >> YAHDLC_CONTROL_RECV_SEQ_NO_BIT);
+    value.recv_seq_no = value.seq_no;
   } else {
-    // It must be an I-frame so add the send sequence number (receive sequence number is not used)
+    // It must be an I-frame so add the send and receive sequence numbers
     value.frame = YAHDLC_FRAME_DATA;
     value.seq_no = (control >> YAHDLC_CONTROL_SEND_SEQ_NO_BIT);
+    value.recv_seq_no = (control >> YAHDLC_CONTROL_RECV_SEQ_NO_BIT);
   }
 
   return value;
@@ -118,6 +136,7 @@ unsigned char yahdlc_frame_control_type(yahdlc_control_t *control)
         case YAHDLC_FRAME_DATA:
             // Create the HDLC I-frame control byte with Poll bit set
             value |= (control->seq_no << YAHDLC_CONTROL_SEND_SEQ_NO_BIT);
+            value |= (control->recv_seq_no << YAHDLC_CONTROL_RECV_SEQ_NO_BIT);
             value |= (1 << YAHDLC_CONTROL_POLL_BIT);
             break;
         case YAHDLC_FRAME_ACK:
@@ -126,11 +145,27 @@ unsigned char yahdlc_frame_control_type(yahdlc_control_t *control)
             value |= (1 << YAHDLC_CONTROL_S_OR_U_FRAME_BIT);
             break;
         case YAHDLC_FRAME_NACK:
-            // Create the HDLC Receive Ready S-frame control byte with Poll bit cleared
+            // Create the HDLC Reject S-frame control byte with Poll bit cleared
             value |= (control->seq_no << YAHDLC_CONTROL_RECV_SEQ_NO_BIT);
             value |= (YAHDLC_CONTROL_TYPE_REJECT << YAHDLC_CONTROL_S_FRAME_TYPE_BIT);
             value |= (1 << YAHDLC_CONTROL_S_OR_U_FRAME_BIT);
             break;
+        case YAHDLC_FRAME_SREJ:
+            // Create the HDLC Selective Reject S-frame control byte with Poll bit cleared
+            value |= (control->seq_no << YAHDLC_CONTROL_RECV_SEQ_NO_BIT);
+            value |= (YAHDLC_CONTROL_TYPE_SELECTIVE_REJECT << YAHDLC_CONTROL_S_FRAME_TYPE_BIT);
+            value |= (1 << YAHDLC_CONTROL_S_OR_U_FRAME_BIT);
+            break;
+        case YAHDLC_FRAME_RNR:
+            // Create the HDLC Receive Not Ready S-frame control byte with Poll bit cleared
+            value |= (control->seq_no << YAHDLC_CONTROL_RECV_SEQ_NO_BIT);
+            value |= (YAHDLC_CONTROL_TYPE_RECEIVE_NOT_READY << YAHDLC_CONTROL_S_FRAME_TYPE_BIT);
+            value |= (1 << YAHDLC_CONTROL_S_OR_U_FRAME_BIT);
+            break;
+        case YAHDLC_FRAME_UI:
+            // Create the HDLC Unnumbered Information U-frame control byte with Poll bit cleared
+            value = YAHDLC_CONTROL_UNNUMBERED_INFO;
+            break;
     }
 
     return value;
@@ -239,51 +274,291 @@ int yahdlc_get_data_with_state(yahdlc_state_t *state, yahdlc_control_t *control,
     return ret;
 }
 
+int yahdlc_get_data_span(yahdlc_state_t *state, yahdlc_control_t *control,
+    const char *src, unsigned int src_len, char *dest, unsigned int dest_size,
+    unsigned int *dest_len, unsigned int *consumed)
+{
+    const char *p = src;
+    const char *end = src + src_len;
+    const char *flag = NULL;
+    const char *run_end;
+    unsigned int run;
+    char value;
+    int ret = -ENOMSG;
+
+    if (!state || !control || (!src && src_len > 0) || !dest || !dest_len
+        || !consumed) {
+        return -EINVAL;
+    }
+    *dest_len = 0;
+
+    // start_index is -1 while hunting for a flag and 0 inside a frame, where
+    // src_index counts the unescaped bytes since the opening flag
+    while (p < end) {
+        if (!flag || flag < p) {
+            flag = (const char *)memchr(p, YAHDLC_FLAG_SEQUENCE, end - p);
+            if (!flag) {
+                flag = end;
+            }
+        }
+
+        if (state->start_index < 0) {
+            if (flag == end) {
+                p = end;
+                break;
+            }
+            p = flag + 1;
+            state->start_index = 0;
+            continue;
+        }
+
+        if (p == flag) {
+            p++;
+            if (state->src_index == 0 && !state->control_escape) {
+                // Back-to-back flags, silently discard (accordingly to HDLC)
+                continue;
+            }
+            // A frame is at least 4 bytes in size and has a valid FCS value
+            if (state->src_index < 4 || state->control_escape
+                || state->fcs != FCS16_GOOD_VALUE) {
+                ret = -EIO;
+            } else {
+                *dest_len = state->dest_index - sizeof(state->fcs);
+                ret = 0;
+            }
+            // The closing flag opens the next frame
+            yahdlc_get_data_reset_with_state(state);
+            state->start_index = 0;
+            break;
+        }
+
+        if (*p == YAHDLC_CONTROL_ESCAPE) {
+            state->control_escape = 1;
+            p++;
+            continue;
+        }
+
+        if (state->control_escape || state->src_index < 2) {
+            // Escaped byte, address or control field: one at a time
+            value = *p++;
+            if (state->control_escape) {
+                state->control_escape = 0;
+                value ^= 0x20;
+            }
+            state->fcs = fcs16(state->fcs, value);
+            if (state->src_index == 1) {
+                *control = yahdlc_get_control_type(value);
+            } else if (state->src_index >= 2) {
+                if ((unsigned int)state->dest_index == dest_size) {
+                    goto oversized;
+                }
+                dest[state->dest_index++] = value;
+            }
+            state->src_index++;
+            continue;
+        }
+
+        // Plain run up to the next flag or escape: copy and checksum in bulk
+        run_end = (const char *)memchr(p, YAHDLC_CONTROL_ESCAPE, flag - p);
+        run = (run_end ? run_end : flag) - p;
+        if (run > dest_size - state->dest_index) {
+            goto oversized;
+        }
+        memcpy(dest + state->dest_index, p, run);
+        state->fcs = fcs16_buf(state->fcs, (const unsigned char *)p, run);
+        state->dest_index += run;
+        state->src_index += run;
+        p += run;
+    }
+
+    *consumed = p - src;
+    return ret;
+
+oversized:
+    // Most likely a lost closing flag merged two frames; resync on a flag
+    yahdlc_get_data_reset_with_state(state);
+    *consumed = p - src;
+    return -EIO;
+}
+
 int yahdlc_frame_data(yahdlc_control_t *control, const char *src,
                       unsigned int src_len, char *dest, unsigned int *dest_len) {
-  unsigned int i;
-  int dest_index = 0;
-  unsigned char value = 0;
-  unsigned short fcs = FCS16_INIT_VALUE;
+  yahdlc_iovec_t iov;
+
+  iov.base = src;
+  iov.len = src_len;
+  return yahdlc_frame_data_iov(control, &iov, 1, dest, dest_len);
+}
+
+int yahdlc_frame_data_iov(yahdlc_control_t *control, const yahdlc_iovec_t *iov,
+                          unsigned int iovcnt, char *dest,
+                          unsigned int *dest_len) {
+  yahdlc_encoder_t enc;
+  int ret;
 
   // Make sure that all parameters are valid
-  if (!control || (!src && (src_len > 0)) || !dest || !dest_len) {
+  if (!dest || !dest_len) {
     return -EINVAL;
   }
+  ret = yahdlc_encode_init(&enc, control, iov, iovcnt);
+  if (ret < 0) {
+    return ret;
+  }
 
-  // Start by adding the start flag sequence
-  dest[dest_index++] = YAHDLC_FLAG_SEQUENCE;
+  // The caller's buffer holds the worst case, every byte escaped
+  *dest_len = yahdlc_encode(&enc, dest, ~0u);
 
-  // Add the all-station address from HDLC (broadcast)
-  fcs = fcs16(fcs, YAHDLC_ALL_STATION_ADDR);
-  yahdlc_escape_value(YAHDLC_ALL_STATION_ADDR, dest, &dest_index);
+  return 0;
+}
 
-  // Add the framed control field value
-  value = yahdlc_frame_control_type(control);
-  fcs = fcs16(fcs, value);
-  yahdlc_escape_value(value, dest, &dest_index);
+// Fields of a frame in the order yahdlc_encode produces them
+enum {
+  YAHDLC_ENC_OPEN,
+  YAHDLC_ENC_ADDRESS,
+  YAHDLC_ENC_CONTROL,
+  YAHDLC_ENC_DATA,
+  YAHDLC_ENC_FCS_LOW,
+  YAHDLC_ENC_FCS_HIGH,
+  YAHDLC_ENC_CLOSE,
+  YAHDLC_ENC_DONE
+};
 
-  // Only DATA frames should contain data
-  if (control->frame == YAHDLC_FRAME_DATA) {
-    // Calculate FCS and escape data
-    for (i = 0; i < src_len; i++) {
-      fcs = fcs16(fcs, src[i]);
-      yahdlc_escape_value(src[i], dest, &dest_index);
+int yahdlc_encode_init(yahdlc_encoder_t *enc, yahdlc_control_t *control,
+                       const yahdlc_iovec_t *iov, unsigned int iovcnt) {
+  unsigned int n;
+
+  // Make sure that all parameters are valid
+  if (!enc || !control || (!iov && (iovcnt > 0))) {
+    return -EINVAL;
+  }
+  for (n = 0; n < iovcnt; n++) {
+    if (!iov[n].base && (iov[n].len > 0)) {
+      return -EINVAL;
     }
   }
 
-  // Invert the FCS value accordingly to the specification
-  fcs ^= 0xFFFF;
+  // Only DATA and UI frames should contain data
+  if (control->frame != YAHDLC_FRAME_DATA && control->frame != YAHDLC_FRAME_UI) {
+    iovcnt = 0;
+  }
+  enc->iov = iov;
+  enc->iovcnt = iovcnt;
+  enc->piece = 0;
+  enc->offset = 0;
+  enc->fcs = FCS16_INIT_VALUE;
+  enc->control = yahdlc_frame_control_type(control);
+  enc->stage = YAHDLC_ENC_OPEN;
+  enc->pending = -1;
+  return 0;
+}
+
+unsigned int yahdlc_encode(yahdlc_encoder_t *enc, char *dest,
+                           unsigned int dest_size) {
+  unsigned int dest_index = 0;
+  const yahdlc_iovec_t *piece;
+  const char *src;
+  unsigned int run, n;
+  char value;
+
+  while (dest_index < dest_size) {
+    // Finish an escape that did not fit last time
+    if (enc->pending >= 0) {
+      dest[dest_index++] = (char)enc->pending;
+      enc->pending = -1;
+      continue;
+    }
+
+    switch (enc->stage) {
+      case YAHDLC_ENC_OPEN:
+        dest[dest_index++] = YAHDLC_FLAG_SEQUENCE;
+        enc->stage = YAHDLC_ENC_ADDRESS;
+        continue;
+      case YAHDLC_ENC_ADDRESS:
+        // The all-station address from HDLC (broadcast)
+        value = (char)YAHDLC_ALL_STATION_ADDR;
+        enc->stage = YAHDLC_ENC_CONTROL;
+        break;
+      case YAHDLC_ENC_CONTROL:
+        value = (char)enc->control;
+        enc->stage = YAHDLC_ENC_DATA;
+        break;
+      case YAHDLC_ENC_DATA:
+        if (enc->piece == enc->iovcnt) {
+          // Invert the FCS value accordingly to the specification
+          enc->fcs ^= 0xFFFF;
+          enc->stage = YAHDLC_ENC_FCS_LOW;
+          continue;
+        }
+        piece = &enc->iov[enc->piece];
+        if (enc->offset == piece->len) {
+          enc->piece++;
+          enc->offset = 0;
+          continue;
+        }
+        src = (const char *)piece->base;
+        if (enc->offset == 0) {
+          // The whole piece goes into the FCS in one block
+          enc->fcs = fcs16_buf(enc->fcs, (const unsigned char *)src,
+                               piece->len);
+        }
+        // Plain bytes straight across, as many as both sides allow; one
+        // bound and one compare per byte (flag and escape are 0x7E, 0x7D)
+        run = piece->len - enc->offset;
+        if (run > dest_size - dest_index) {
+          run = dest_size - dest_index;
+        }
+        src += enc->offset;
+        for (n = 0; n < run; n++) {
+          value = src[n];
+          if ((unsigned char)(value - YAHDLC_CONTROL_ESCAPE) < 2) {
+            break;
+          }
+          dest[dest_index + n] = value;
+        }
+        dest_index += n;
+        enc->offset += n;
+        if (n == run) {
+          continue;
+        }
+        // Then the byte that stopped the run
+        enc->offset++;
+        goto escape;
+      case YAHDLC_ENC_FCS_LOW:
+        value = (char)(enc->fcs & 0xFF);
+        enc->stage = YAHDLC_ENC_FCS_HIGH;
+        goto escape;
+      case YAHDLC_ENC_FCS_HIGH:
+        value = (char)((enc->fcs >> 8) & 0xFF);
+        enc->stage = YAHDLC_ENC_CLOSE;
+        goto escape;
+      case YAHDLC_ENC_CLOSE:
+        dest[dest_index++] = YAHDLC_FLAG_SEQUENCE;
+        enc->stage = YAHDLC_ENC_DONE;
+        continue;
+      default:
+        return dest_index;
+    }
 
-  // Run through the FCS bytes and escape the values
-  for (i = 0; i < sizeof(fcs); i++) {
-    value = ((fcs >> (8 * i)) & 0xFF);
-    yahdlc_escape_value(value, dest, &dest_index);
+    // Address and control bytes are covered by the FCS (data pieces were
+    // added whole as they were started)
+    enc->fcs = fcs16(enc->fcs, value);
+
+escape:
+    // Check and escape the value if needed
+    if ((value == YAHDLC_FLAG_SEQUENCE) || (value == YAHDLC_CONTROL_ESCAPE)) {
+      dest[dest_index++] = YAHDLC_CONTROL_ESCAPE;
+      value ^= 0x20;
+      if (dest_index == dest_size) {
+        enc->pending = (unsigned char)value;
+        break;
+      }
+    }
+    dest[dest_index++] = value;
   }
 
-  // Add end flag sequence and update length of frame
-  dest[dest_index++] = YAHDLC_FLAG_SEQUENCE;
-  *dest_len = dest_index;
+  return dest_index;
+}
 
-  return 0;
-}
\ No newline at end of file
+int yahdlc_encode_done(const yahdlc_encoder_t *enc) {
+  return enc->stage == YAHDLC_ENC_DONE && enc->pending < 0;
+}
@@ -43,15 +43,40 @@
 typedef enum {
     YAHDLC_FRAME_DATA,
     YAHDLC_FRAME_ACK,
-    YAHDLC_FRAME_NACK,
+    YAHDLC_FRAME_NACK,      /**< REJ: resend everything from seq_no */
+    YAHDLC_FRAME_SREJ,      /**< SREJ: resend frame seq_no only */
+    YAHDLC_FRAME_RNR,       /**< RNR: ACK up to seq_no, then hold off */
+    YAHDLC_FRAME_UI,        /**< UI: unnumbered data, never acknowledged */
 } yahdlc_frame_t;
 
 /** Control field information */
 typedef struct {
     yahdlc_frame_t frame;
     unsigned char seq_no :3;
+    unsigned char recv_seq_no :3;   /**< N(R) of an I-frame: next seq_no expected */
 } yahdlc_control_t;
 
+/** One piece of a frame's data field, see yahdlc_frame_data_iov */
+typedef struct {
+    const void *base;
+    unsigned int len;
+} yahdlc_iovec_t;
+
+/**
+ * Where an incremental encode is, see yahdlc_encode_init. The fields are
+ * private to yahdlc.cpp.
+ */
+typedef struct {
+    const yahdlc_iovec_t *iov;
+    unsigned int iovcnt;
+    unsigned int piece;         /**< iov being encoded */
+    unsigned int offset;        /**< next byte in it */
+    unsigned short fcs;
+    unsigned char control;      /**< framed control field */
+    unsigned char stage;        /**< next field to produce */
+    int pending;                /**< second byte of an escape, or -1 */
+} yahdlc_encoder_t;
+
 /** Variables used in yahdlc_get_data and yahdlc_get_data_with_state
  * to keep track of received buffers
  */
@@ -100,6 +125,9 @@ int yahdlc_get_state(yahdlc_state_t *state);
  * @retval -ENOMSG Invalid message
  * @retval -EIO Invalid FCS (size of dest_len should be discarded from source buffer)
  *
+ * The decoder state is a single static shared by all callers; code serving
+ * more than one stream must keep its own yahdlc_state_t.
+ *
  * @see yahdlc_get_data_with_state
  */
 int yahdlc_get_data(yahdlc_control_t *control, const char *src,
@@ -118,6 +146,31 @@ int yahdlc_get_data(yahdlc_control_t *control, const char *src,
 int yahdlc_get_data_with_state(yahdlc_state_t *state, yahdlc_control_t *control, const char *src,
                                unsigned int src_len, char *dest, unsigned int *dest_len);
 
+/**
+ * Decodes a contiguous span of received bytes, stopping after the first
+ * complete frame. Unlike @ref yahdlc_get_data_with_state the input is scanned
+ * for flags and escapes in bulk and the unescaped runs in between are copied
+ * and checksummed as blocks, so callers should hand over everything they have
+ * buffered rather than single bytes. The closing flag of a frame also opens
+ * the next one.
+ *
+ * @param[in,out] state Decoder state, reset with yahdlc_get_data_reset_with_state
+ * @param[out] control Control field structure with frame type and sequence number
+ * @param[in] src Source buffer
+ * @param[in] src_len Source buffer length
+ * @param[out] dest Destination buffer for the data field and the two FCS bytes
+ * @param[in] dest_size Size of @p dest; longer frames are dropped with -EIO
+ * @param[out] dest_len Length of the data field of a complete frame
+ * @param[out] consumed Number of bytes of @p src that were used up
+ * @retval 0 A complete frame with a valid FCS is in @p dest
+ * @retval -EINVAL Invalid parameter
+ * @retval -ENOMSG All of @p src was consumed without completing a frame
+ * @retval -EIO An invalid, oversized or corrupted frame was discarded
+ */
+int yahdlc_get_data_span(yahdlc_state_t *state, yahdlc_control_t *control,
+                         const char *src, unsigned int src_len, char *dest,
+                         unsigned int dest_size, unsigned int *dest_len,
+                         unsigned int *consumed);
 
 /**
  * Resets values used in yahdlc_get_data function to keep track of received buffers
@@ -149,6 +202,61 @@ void yahdlc_get_data_reset_with_state(yahdlc_state_t *state);
 int yahdlc_frame_data(yahdlc_control_t *control, const char *src,
                       unsigned int src_len, char *dest, unsigned int *dest_len);
 
+/**
+ * Creates HDLC frame whose data field is the @p iovcnt pieces at @p iov, one
+ * after the other. Each byte is checksummed and escaped straight into
+ * @p dest, so the pieces never have to be put together first.
+ *
+ * @param[in] control Control field structure with frame type and sequence number
+ * @param[in] iov Pieces of the data field, in order
+ * @param[in] iovcnt Number of pieces
+ * @param[out] dest Destination buffer, 2 * (data length + 6) bytes at most
+ * @param[out] dest_len Destination buffer length
+ * @retval 0 Success
+ * @retval -EINVAL Invalid parameter
+ */
+int yahdlc_frame_data_iov(yahdlc_control_t *control, const yahdlc_iovec_t *iov,
+                          unsigned int iovcnt, char *dest,
+                          unsigned int *dest_len);
+
+/**
+ * Starts encoding a frame piece by piece, see yahdlc_encode. The pieces are
+ * read as they are encoded, so they must stay as they are until the frame
+ * is done.
+ *
+ * @param[out] enc Encoder state
+ * @param[in] control Control field structure with frame type and sequence number
+ * @param[in] iov Pieces of the data field, in order; only DATA and UI frames
+ * have one
+ * @param[in] iovcnt Number of pieces
+ * @retval 0 Success
+ * @retval -EINVAL Invalid parameter
+ */
+int yahdlc_encode_init(yahdlc_encoder_t *enc, yahdlc_control_t *control,
+                       const yahdlc_iovec_t *iov, unsigned int iovcnt);
+
+/**
+ * Produces the next bytes of the frame started with yahdlc_encode_init:
+ * flag, address, control, escaped data, FCS and closing flag, as many as fit.
+ *
+ * @param[in,out] enc Encoder state
+ * @param[out] dest Destination buffer
+ * @param[in] dest_size Room in @p dest
+ * @returns Number of bytes written to @p dest; fewer than @p dest_size only
+ * once the frame is done
+ */
+unsigned int yahdlc_encode(yahdlc_encoder_t *enc, char *dest,
+                           unsigned int dest_size);
+
+/**
+ * Tells whether the frame started with yahdlc_encode_init is all out.
+ *
+ * @param[in] enc Encoder state
+ * @retval 1 Every byte of the frame has been produced
+ * @retval 0 There is more
+ */
+int yahdlc_encode_done(const yahdlc_encoder_t *enc);
+
 #ifdef __cplusplus
 }
 #endif